@@ -475,6 +475,24 @@ static int pushcapture (CapState *cs) {
       lua_pushvalue(L, (cs->cap++)->idx);  /* value is in the stack */
       return 1;
     }
+    case Clower: {  /* whole match in lower case; ignores nested values */
+      luaL_Buffer b;
+      const char *s = cs->cap->s;
+      const char *e;
+      if (isfullcap(cs->cap)) {
+        e = closeaddr(cs->cap);
+        cs->cap++;
+      }
+      else {
+        nextcap(cs);
+        e = (cs->cap - 1)->s;  /* close entry marks the end */
+      }
+      luaL_buffinit(L, &b);
+      for (; s < e; s++)
+        luaL_addchar(&b, foldchar((byte)*s));
+      luaL_pushresult(&b);
+      return 1;
+    }
     case Cstring: {
       luaL_Buffer b;
       luaL_buffinit(L, &b);
@@ -25,7 +25,8 @@ typedef enum CapKind {
   Csubst,  /* substitution capture; next node is pattern */
   Cfold,  /* ktable[key] is function; next node is pattern */
   Cruntime,  /* not used in trees (is uses another type for tree) */
-  Cgroup  /* ktable[key] is group's "name" */
+  Cgroup,  /* ktable[key] is group's "name" */
+  Clower  /* next node is pattern */
 } CapKind;
 
 
@@ -120,11 +120,35 @@ int tocharset (TTree *tree, Charset *cs) {
       loopset(i, cs->cs[i] = 0xFF);  /* add all characters to the set */
       return 1;
     }
+    case TCharI: {  /* letter in both cases */
+      loopset(i, cs->cs[i] = 0);
+      setchar(cs->cs, tree->u.n);
+      setchar(cs->cs, upperchar(tree->u.n));
+      return 1;
+    }
     default: return 0;
   }
 }
 
 
+/*
+** number of bytes in the UTF-8 encoding of code point 'cp'
+*/
+static int utflen (int cp) {
+  return (cp < 0x80) ? 1 : (cp < 0x800) ? 2 : (cp < 0x10000) ? 3 : 4;
+}
+
+
+/*
+** first byte of the UTF-8 encoding of code point 'cp'
+*/
+static int utflead (int cp) {
+  static const int marks[] = {0, 0, 0xC0, 0xE0, 0xF0};
+  int len = utflen(cp);
+  return marks[len] | (cp >> (6 * (len - 1)));
+}
+
+
 /*
 ** Visit a TCall node taking care to stop recursion. If node not yet
 ** visited, return 'f(sib2(tree))', otherwise return 'def' (default
@@ -196,12 +220,13 @@ int hascaptures (TTree *tree) {
 int checkaux (TTree *tree, int pred) {
  tailcall:
   switch (tree->tag) {
-    case TChar: case TSet: case TAny:
-    case TFalse: case TOpenCall:
+    case TChar: case TSet: case TAny: case TUTFR: case TCharI:
+    case TKeywords: case TFalse: case TOpenCall:
       return 0;  /* not nullable */
     case TRep: case TTrue:
       return 1;  /* no fail */
     case TNot: case TBehind:  /* can match empty, but can fail */
+    case TLineStart: case TLastChar:
       if (pred == PEnofail) return 0;
       else return 1;  /* PEnullable */
     case TAnd:  /* can match empty; fail iff body does */
@@ -220,7 +245,7 @@ int checkaux (TTree *tree, int pred) {
       if (checkaux(sib2(tree), pred)) return 1;
       /* else return checkaux(sib1(tree), pred); */
       tree = sib1(tree); goto tailcall;
-    case TCapture: case TGrammar: case TRule:
+    case TCapture: case TGrammar: case TRule: case TMemo:
       /* return checkaux(sib1(tree), pred); */
       tree = sib1(tree); goto tailcall;
     case TCall:  /* return checkaux(sib2(tree), pred); */
@@ -237,13 +262,21 @@ int fixedlen (TTree *tree) {
   int len = 0;  /* to accumulate in tail calls */
  tailcall:
   switch (tree->tag) {
-    case TChar: case TSet: case TAny:
+    case TChar: case TSet: case TAny: case TCharI:
       return len + 1;
+    case TUTFR: {  /* fixed iff both ends have encodings of same length */
+      int n1 = utflen(tree->u.n);
+      if (n1 != utflen((tree + 1)->u.n))
+        return -1;
+      else
+        return len + n1;
+    }
     case TFalse: case TTrue: case TNot: case TAnd: case TBehind:
+    case TLineStart: case TLastChar:
       return len;
-    case TRep: case TRunTime: case TOpenCall:
+    case TRep: case TRunTime: case TOpenCall: case TKeywords:
       return -1;
-    case TCapture: case TRule: case TGrammar:
+    case TCapture: case TRule: case TGrammar: case TMemo:
       /* return fixedlen(sib1(tree)); */
       tree = sib1(tree); goto tailcall;
     case TCall: {
@@ -294,11 +327,22 @@ int fixedlen (TTree *tree) {
 static int getfirst (TTree *tree, const Charset *follow, Charset *firstset) {
  tailcall:
   switch (tree->tag) {
-    case TChar: case TSet: case TAny: {
+    case TChar: case TSet: case TAny: case TCharI: {
       tocharset(tree, firstset);
       return 0;
     }
-    case TTrue: {
+    case TKeywords: {  /* a word starts with a word char */
+      loopset(i, firstset->cs[i] = treebuffer(tree)[i]);
+      return 0;
+    }
+    case TUTFR: {  /* lead bytes grow with code points */
+      int c;
+      loopset(i, firstset->cs[i] = 0);
+      for (c = utflead(tree->u.n); c <= utflead((tree + 1)->u.n); c++)
+        setchar(firstset->cs, c);
+      return 0;
+    }
+    case TTrue: case TLineStart: case TLastChar: {
       loopset(i, firstset->cs[i] = follow->cs[i]);
       return 1;  /* accepts the empty string */
     }
@@ -334,7 +378,7 @@ static int getfirst (TTree *tree, const Charset *follow, Charset *firstset) {
       loopset(i, firstset->cs[i] |= follow->cs[i]);
       return 1;  /* accept the empty string */
     }
-    case TCapture: case TGrammar: case TRule: {
+    case TCapture: case TGrammar: case TRule: case TMemo: {
       /* return getfirst(sib1(tree), follow, firstset); */
       tree = sib1(tree); goto tailcall;
     }
@@ -377,12 +421,14 @@ static int getfirst (TTree *tree, const Charset *follow, Charset *firstset) {
 static int headfail (TTree *tree) {
  tailcall:
   switch (tree->tag) {
-    case TChar: case TSet: case TAny: case TFalse:
+    case TChar: case TSet: case TAny: case TFalse: case TCharI:
       return 1;
     case TTrue: case TRep: case TRunTime: case TNot:
-    case TBehind:
+    case TBehind: case TLineStart: case TLastChar:
+    case TUTFR:  /* may fail on a continuation byte */
+    case TKeywords:  /* may fail after the whole word */
       return 0;
-    case TCapture: case TGrammar: case TRule: case TAnd:
+    case TCapture: case TGrammar: case TRule: case TAnd: case TMemo:
       tree = sib1(tree); goto tailcall;  /* return headfail(sib1(tree)); */
     case TCall:
       tree = sib2(tree); goto tailcall;  /* return headfail(sib2(tree)); */
@@ -407,13 +453,14 @@ static int headfail (TTree *tree) {
 static int needfollow (TTree *tree) {
  tailcall:
   switch (tree->tag) {
-    case TChar: case TSet: case TAny:
+    case TChar: case TSet: case TAny: case TCharI:
     case TFalse: case TTrue: case TAnd: case TNot:
     case TRunTime: case TGrammar: case TCall: case TBehind:
+    case TLineStart: case TLastChar: case TUTFR: case TKeywords:
       return 0;
     case TChoice: case TRep:
       return 1;
-    case TCapture:
+    case TCapture: case TMemo:
       tree = sib1(tree); goto tailcall;
     case TSeq:
       tree = sib2(tree); goto tailcall;
@@ -437,10 +484,13 @@ static int needfollow (TTree *tree) {
 */
 int sizei (const Instruction *i) {
   switch((Opcode)i->i.code) {
-    case ISet: case ISpan: return CHARSETINSTSIZE;
+    case ISet: case ISpan: case ILastChar: case IKeywords:
+      return CHARSETINSTSIZE;
     case ITestSet: return CHARSETINSTSIZE + 1;
+    case IUTFR: return 3;
     case ITestChar: case ITestAny: case IChoice: case IJmp: case ICall:
     case IOpenCall: case ICommit: case IPartialCommit: case IBackCommit:
+    case IMemo:
       return 2;
     default: return 1;
   }
@@ -453,6 +503,7 @@ int sizei (const Instruction *i) {
 typedef struct CompileState {
   Pattern *p;  /* pattern being compiled */
   int ncode;  /* next position in p->code to be filled */
+  int nmemo;  /* number of memo ids already given */
   lua_State *L;
 } CompileState;
 
@@ -567,6 +618,34 @@ static void codechar (CompileState *compst, int c, int tt) {
 }
 
 
+/*
+** code a letter ignoring case; also use an IAny when instruction is
+** dominated by an equivalent test.
+*/
+static void codechari (CompileState *compst, TTree *tree, int tt) {
+  Charset cs;
+  tocharset(tree, &cs);
+  if (tt >= 0 && getinstr(compst, tt).i.code == ITestSet &&
+      cs_equal(cs.cs, getinstr(compst, tt + 2).buff))
+    addinstruction(compst, IAny, 0);
+  else
+    addinstruction(compst, ICharI, tree->u.n);
+}
+
+
+/*
+** code a range of UTF-8 code points: the instruction is followed by
+** its first and last code points
+*/
+static void codeutfr (CompileState *compst, TTree *tree) {
+  int i = addinstruction(compst, IUTFR, 0);
+  addinstruction(compst, (Opcode)0, 0);  /* space for first code point */
+  addinstruction(compst, (Opcode)0, 0);  /* space for last code point */
+  getinstr(compst, i + 1).offset = tree->u.n;
+  getinstr(compst, i + 2).offset = (tree + 1)->u.n;
+}
+
+
 /*
 ** Add a charset posfix to an instruction
 */
@@ -663,6 +742,32 @@ static void codebehind (CompileState *compst, TTree *tree) {
 }
 
 
+/*
+** <memo(p)> ==
+**     memo L1 (id)
+**     <p>
+**     memocommit (id)
+**     memofail (id)
+** L1:
+** Ids are numbered per compiled pattern; patterns with more memos than
+** fit in a key are compiled without memoization.
+*/
+static void codememo (CompileState *compst, TTree *tree, const Charset *fl) {
+  int id, pmemo;
+  if (compst->nmemo >= SHRT_MAX) {  /* no more ids? */
+    codegen(compst, sib1(tree), 0, NOINST, fl);
+    return;
+  }
+  id = ++compst->nmemo;
+  pmemo = addoffsetinst(compst, IMemo);
+  getinstr(compst, pmemo).i.key = id;
+  codegen(compst, sib1(tree), 0, NOINST, fl);
+  getinstr(compst, addinstruction(compst, IMemoCommit, 0)).i.key = id;
+  getinstr(compst, addinstruction(compst, IMemoFail, 0)).i.key = id;
+  jumptohere(compst, pmemo);
+}
+
+
 /*
 ** Choice; optimizations:
 ** - when p1 is headfail or
@@ -928,6 +1033,21 @@ static void codegen (CompileState *compst, TTree *tree, int opt, int tt,
     case TChoice: codechoice(compst, sib1(tree), sib2(tree), opt, fl); break;
     case TRep: coderep(compst, sib1(tree), opt, fl); break;
     case TBehind: codebehind(compst, tree); break;
+    case TLineStart: addinstruction(compst, ILineStart, 0); break;
+    case TLastChar: {
+      addinstruction(compst, ILastChar, 0);
+      addcharset(compst, treebuffer(tree));
+      break;
+    }
+    case TUTFR: codeutfr(compst, tree); break;
+    case TCharI: codechari(compst, tree, tt); break;
+    case TKeywords: {
+      int i = addinstruction(compst, IKeywords, tree->cap);
+      getinstr(compst, i).i.key = tree->key;
+      addcharset(compst, treebuffer(tree));
+      break;
+    }
+    case TMemo: codememo(compst, tree, fl); break;
     case TNot: codenot(compst, sib1(tree)); break;
     case TAnd: codeand(compst, sib1(tree), tt); break;
     case TCapture: codecapture(compst, tree, tt, fl); break;
@@ -1000,7 +1120,7 @@ static void peephole (CompileState *compst) {
 */
 Instruction *compile (lua_State *L, Pattern *p) {
   CompileState compst;
-  compst.p = p;  compst.ncode = 0;  compst.L = L;
+  compst.p = p;  compst.ncode = 0;  compst.nmemo = 0;  compst.L = L;
   realloccode(L, p, 2);  /* minimum initial size */
   codegen(&compst, p->tree, 0, NOINST, fullset);
   addinstruction(&compst, IEnd, 0);
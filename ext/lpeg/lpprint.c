@@ -42,7 +42,7 @@ static const char *capkind (int kind) {
     "close", "position", "constant", "backref",
     "argument", "simple", "table", "function",
     "query", "string", "num", "substitution", "fold",
-    "runtime", "group"};
+    "runtime", "group", "lower"};
   return modes[kind];
 }
 
@@ -60,11 +60,13 @@ void printinst (const Instruction *op, const Instruction *p) {
     "ret", "end",
     "choice", "jmp", "call", "open_call",
     "commit", "partial_commit", "back_commit", "failtwice", "fail", "giveup",
-     "fullcapture", "opencapture", "closecapture", "closeruntime"
+     "fullcapture", "opencapture", "closecapture", "closeruntime",
+     "linestart", "lastchar", "utfr", "chari",
+     "memo", "memocommit", "memofail", "keywords"
   };
   printf("%02ld: %s ", (long)(p - op), names[p->i.code]);
   switch ((Opcode)p->i.code) {
-    case IChar: {
+    case IChar: case ICharI: {
       printf("'%c'", p->i.aux);
       break;
     }
@@ -89,7 +91,12 @@ void printinst (const Instruction *op, const Instruction *p) {
       printcharset((p+2)->buff); printjmp(op, p);
       break;
     }
-    case ISpan: {
+    case ISpan: case ILastChar: {
+      printcharset((p+1)->buff);
+      break;
+    }
+    case IKeywords: {
+      printf("(idx = %d%s) ", p->i.key, p->i.aux ? ", folded" : "");
       printcharset((p+1)->buff);
       break;
     }
@@ -101,6 +108,18 @@ void printinst (const Instruction *op, const Instruction *p) {
       printf("%d", p->i.aux);
       break;
     }
+    case IUTFR: {
+      printf("%d - %d", (p + 1)->offset, (p + 2)->offset);
+      break;
+    }
+    case IMemo: {
+      printf("(id = %d) ", p->i.key); printjmp(op, p);
+      break;
+    }
+    case IMemoCommit: case IMemoFail: {
+      printf("(id = %d)", p->i.key);
+      break;
+    }
     case IJmp: case ICall: case ICommit: case IChoice:
     case IPartialCommit: case IBackCommit: case ITestAny: {
       printjmp(op, p);
@@ -153,7 +172,9 @@ static const char *tagnames[] = {
   "not", "and",
   "call", "opencall", "rule", "grammar",
   "behind",
-  "capture", "run-time"
+  "capture", "run-time",
+  "linestart", "lastchar", "utfr", "chari",
+  "memo", "keywords"
 };
 
 
@@ -162,7 +183,7 @@ void printtree (TTree *tree, int ident) {
   for (i = 0; i < ident; i++) printf(" ");
   printf("%s", tagnames[tree->tag]);
   switch (tree->tag) {
-    case TChar: {
+    case TChar: case TCharI: {
       int c = tree->u.n;
       if (isprint(c))
         printf(" '%c'\n", c);
@@ -170,7 +191,13 @@ void printtree (TTree *tree, int ident) {
         printf(" (%02X)\n", c);
       break;
     }
-    case TSet: {
+    case TSet: case TLastChar: {
+      printcharset(treebuffer(tree));
+      printf("\n");
+      break;
+    }
+    case TKeywords: {
+      printf(" key: %d%s ", tree->key, tree->cap ? "  folded" : "");
       printcharset(treebuffer(tree));
       printf("\n");
       break;
@@ -180,6 +207,10 @@ void printtree (TTree *tree, int ident) {
       printf(" key: %d  (rule: %d)\n", tree->key, sib2(tree)->cap);
       break;
     }
+    case TUTFR: {
+      printf(" %d - %d\n", tree->u.n, (tree + 1)->u.n);
+      break;
+    }
     case TBehind: {
       printf(" %d\n", tree->u.n);
         printtree(sib1(tree), ident + 2);
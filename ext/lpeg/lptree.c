@@ -27,7 +27,12 @@ const byte numsiblings[] = {
   1, 1,		/* not, and */
   0, 0, 2, 1,  /* call, opencall, rule, grammar */
   1,  /* behind */
-  1, 1  /* capture, runtime capture */
+  1, 1,  /* capture, runtime capture */
+  0, 0,  /* line start, last char */
+  0,  /* utf range */
+  0,  /* char ignoring case */
+  1,  /* memo */
+  0  /* keywords */
 };
 
 
@@ -215,7 +220,7 @@ static void correctkeys (TTree *tree, int n) {
   if (n == 0) return;  /* no correction? */
  tailcall:
   switch (tree->tag) {
-    case TOpenCall: case TCall: case TRunTime: case TRule: {
+    case TOpenCall: case TCall: case TRunTime: case TRule: case TKeywords: {
       if (tree->key > 0)
         tree->key += n;
       break;
@@ -674,6 +679,137 @@ static int lp_range (lua_State *L) {
 }
 
 
+/*
+** Literal string matched ignoring (ASCII) case: letters become
+** TCharI nodes, other characters stay TChar nodes
+*/
+static int lp_Pi (lua_State *L) {
+  size_t slen, i;
+  const char *s = luaL_checklstring(L, 1, &slen);
+  if (slen == 0)  /* empty? */
+    newleaf(L, TTrue);  /* always match */
+  else {
+    TTree *tree = newtree(L, 2 * (slen - 1) + 1);
+    fillseq(tree, TChar, slen, s);
+    for (i = 0; i < 2 * (slen - 1) + 1; i++) {
+      int c = foldchar(tree[i].u.n);
+      if (tree[i].tag == TChar && 'a' <= c && c <= 'z') {  /* letter? */
+        tree[i].tag = TCharI;
+        tree[i].u.n = c;
+      }
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Keyword set: matches the longest (non-empty) run of characters from
+** set 'chars' if that run is one of the strings in list 'words'
+** (ignoring ASCII case if 'fold' is true). The words go into a hash
+** table that the VM searches in place, without creating Lua strings.
+*/
+static int lp_keywords (lua_State *L) {
+  size_t l, total = 0;
+  const char *s = luaL_checklstring(L, 2, &l);
+  int fold = lua_toboolean(L, 3);
+  lua_Integer i, n;
+  unsigned int nslots = 1;
+  int setidx;
+  KeywordSet *set;
+  char *words;
+  TTree *tree;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  n = luaL_len(L, 1);
+  for (i = 1; i <= n; i++) {
+    size_t wl;
+    lua_rawgeti(L, 1, i);
+    luaL_argcheck(L, lua_type(L, -1) == LUA_TSTRING, 1,
+                  "list of strings expected");
+    lua_tolstring(L, -1, &wl);
+    total += wl;
+    lua_pop(L, 1);
+  }
+  luaL_argcheck(L, n <= INT_MAX / 4 && total <= INT_MAX / 2, 1,
+                "too many words");
+  while (nslots < 2 * n)  /* keep the table at most half full */
+    nslots *= 2;
+  set = (KeywordSet *)lua_newuserdata(L, keywordsetsize(nslots) + total);
+  setidx = lua_gettop(L);
+  set->mask = nslots - 1;
+  set->maxlen = 0;
+  for (i = 0; i < nslots; i++)
+    set->slot[i].len = 0;
+  words = (char *)set + keywordsetsize(nslots);
+  for (i = 1; i <= n; i++) {
+    size_t wl, j;
+    const char *w;
+    lua_rawgeti(L, 1, i);
+    w = lua_tolstring(L, -1, &wl);
+    for (j = 0; j < wl; j++)
+      words[j] = fold ? foldchar((byte)w[j]) : w[j];
+    lua_pop(L, 1);
+    if (wl > 0) {  /* empty words never match */
+      unsigned int h = keywordhash(words, wl, fold);
+      KeywordSlot *slot = findkeyword(set, h, words, wl, fold);
+      if (slot->len == 0) {  /* not a repeated word? */
+        slot->hash = h;
+        slot->len = (unsigned int)wl;
+        slot->offset = (unsigned int)(words - (char *)set);
+        if (wl > set->maxlen) set->maxlen = (unsigned int)wl;
+        words += wl;
+      }
+    }
+  }
+  tree = newcharset(L);
+  tree->tag = TKeywords;
+  tree->cap = fold;
+  while (l--) {
+    setchar(treebuffer(tree), (byte)(*s));
+    s++;
+  }
+  tree->key = addtonewktable(L, 0, setidx);
+  return 1;
+}
+
+
+/*
+** Range of UTF-8 code points; ranges inside ASCII become ordinary
+** charsets
+*/
+static int lp_utfr (lua_State *L) {
+  lua_Integer from = luaL_checkinteger(L, 1);
+  lua_Integer to = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, 0 <= from && from <= MAXUTF, 1, "code point out of range");
+  luaL_argcheck(L, from <= to && to <= MAXUTF, 2, "code point out of range");
+  if (to <= 0x7F) {  /* ASCII range? */
+    int c;
+    TTree *tree = newcharset(L);
+    for (c = (int)from; c <= (int)to; c++)
+      setchar(treebuffer(tree), c);
+  }
+  else {
+    TTree *tree = newtree(L, 2);
+    tree->tag = TUTFR;
+    tree->u.n = (int)from;
+    (tree + 1)->tag = TUTFR;
+    (tree + 1)->u.n = (int)to;
+  }
+  return 1;
+}
+
+
+/*
+** Memoized pattern: results of 'p' at each position are remembered
+** (within a bounded table) for the rest of the match
+*/
+static int lp_memo (lua_State *L) {
+  getpatt(L, 1, NULL);
+  newroot1sib(L, TMemo);
+  return 1;
+}
+
+
 /*
 ** Look-behind predicate
 */
@@ -690,6 +826,32 @@ static int lp_behind (lua_State *L) {
 }
 
 
+/*
+** Line-start predicate
+*/
+static int lp_linestart (lua_State *L) {
+  newleaf(L, TLineStart);
+  return 1;
+}
+
+
+/*
+** Last-character predicate: checks the last character before the
+** current position that is not a space against a set
+*/
+static int lp_lastchar (lua_State *L) {
+  size_t l;
+  const char *s = luaL_checklstring(L, 1, &l);
+  TTree *tree = newcharset(L);
+  tree->tag = TLastChar;
+  while (l--) {
+    setchar(treebuffer(tree), (byte)(*s));
+    s++;
+  }
+  return 1;
+}
+
+
 /*
 ** Create a non-terminal
 */
@@ -794,6 +956,11 @@ static int lp_simplecapture (lua_State *L) {
 }
 
 
+static int lp_lowercapture (lua_State *L) {
+  return capture_aux(L, Clower, 0);
+}
+
+
 static int lp_poscapture (lua_State *L) {
   newemptycap(L, Cposition);
   return 1;
@@ -1003,16 +1170,17 @@ static int verifyrule (lua_State *L, TTree *tree, int *passed, int npassed,
                        int nb) {
  tailcall:
   switch (tree->tag) {
-    case TChar: case TSet: case TAny:
-    case TFalse:
+    case TChar: case TSet: case TAny: case TUTFR: case TCharI:
+    case TKeywords: case TFalse:
       return nb;  /* cannot pass from here */
     case TTrue:
     case TBehind:  /* look-behind cannot have calls */
+    case TLineStart: case TLastChar:
       return 1;
     case TNot: case TAnd: case TRep:
       /* return verifyrule(L, sib1(tree), passed, npassed, 1); */
       tree = sib1(tree); nb = 1; goto tailcall;
-    case TCapture: case TRunTime:
+    case TCapture: case TRunTime: case TMemo:
       /* return verifyrule(L, sib1(tree), passed, npassed, nb); */
       tree = sib1(tree); goto tailcall;
     case TCall:
@@ -1107,6 +1275,26 @@ static Instruction *prepcompile (lua_State *L, Pattern *p, int idx) {
 }
 
 
+/*
+** Return the sizes of a pattern: tree nodes, instructions of its
+** compiled code (compiling it if needed), entries in its ktable, and
+** bytes its tree and code take
+*/
+static int lp_footprint (lua_State *L) {
+  Pattern *p = getpattern(L, 1);
+  if (p->code == NULL)
+    prepcompile(L, p, 1);
+  lua_pushinteger(L, getsize(L, 1));
+  lua_pushinteger(L, p->codesize);
+  lua_getuservalue(L, 1);
+  lua_pushinteger(L, ktablelen(L, -1));
+  lua_remove(L, -2);  /* remove 'ktable' */
+  lua_pushinteger(L, getsize(L, 1) * sizeof(TTree) +
+                     p->codesize * sizeof(Instruction));
+  return 4;
+}
+
+
 static int lp_printtree (lua_State *L) {
   TTree *tree = getpatt(L, 1, NULL);
   int c = lua_toboolean(L, 2);
@@ -1165,6 +1353,7 @@ static int lp_match (lua_State *L) {
   lua_pushnil(L);  /* initialize subscache */
   lua_pushlightuserdata(L, capture);  /* initialize caplistidx */
   lua_getuservalue(L, 1);  /* initialize penvidx */
+  lua_pushnil(L);  /* initialize memoidx */
   r = match(L, s, s + i, s + l, code, capture, ptop);
   if (r == NULL) {
     lua_pushnil(L);
@@ -1193,6 +1382,22 @@ static int lp_setmax (lua_State *L) {
 }
 
 
+/*
+** Return number of memo lookups, hits, and stored results of this
+** Lua state since last reset; reset counters if asked to
+*/
+static int lp_memostats (lua_State *L) {
+  MemoStats *memostats = getmemostats(L);
+  int reset = lua_toboolean(L, 1);  /* read before pushing the results */
+  lua_pushinteger(L, memostats->lookups);
+  lua_pushinteger(L, memostats->hits);
+  lua_pushinteger(L, memostats->stores);
+  if (reset)
+    memostats->lookups = memostats->hits = memostats->stores = 0;
+  return 3;
+}
+
+
 static int lp_version (lua_State *L) {
   lua_pushstring(L, VERSION);
   return 1;
@@ -1253,8 +1458,12 @@ static struct luaL_Reg pattreg[] = {
   {"pcode", lp_printcode},
   {"match", lp_match},
   {"B", lp_behind},
+  {"M", lp_memo},
+  {"linestart", lp_linestart},
+  {"lastchar", lp_lastchar},
   {"V", lp_V},
   {"C", lp_simplecapture},
+  {"Cl", lp_lowercapture},
   {"Cc", lp_constcapture},
   {"Cmt", lp_matchtime},
   {"Cb", lp_backref},
@@ -1265,11 +1474,16 @@ static struct luaL_Reg pattreg[] = {
   {"Cf", lp_foldcapture},
   {"Cg", lp_groupcapture},
   {"P", lp_P},
+  {"Pi", lp_Pi},
+  {"keywords", lp_keywords},
   {"S", lp_set},
   {"R", lp_range},
+  {"utfR", lp_utfr},
   {"locale", lp_locale},
   {"version", lp_version},
   {"setmaxstack", lp_setmax},
+  {"memostats", lp_memostats},
+  {"footprint", lp_footprint},
   {"type", lp_type},
   {NULL, NULL}
 };
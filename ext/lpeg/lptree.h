@@ -33,8 +33,17 @@ typedef enum TTag {
   TCapture,  /* captures: 'cap' is kind of capture (enum 'CapKind');
                 ktable[key] is Lua value associated with capture;
                 'sib1' is capture body */
-  TRunTime  /* run-time capture: 'key' is Lua function;
+  TRunTime,  /* run-time capture: 'key' is Lua function;
                'sib1' is capture body */
+  TLineStart,  /* succeeds at the subject start or after a line break */
+  TLastChar,  /* the set of the last non-space char is stored in next
+                CHARSETSIZE bytes */
+  TUTFR,  /* range of UTF-8 code points: 'n' is the first code point;
+            'n' of next slot is the last one */
+  TCharI,  /* 'n' = lower-case letter, matched ignoring case */
+  TMemo,  /* 'sib1' is pattern whose results are memoized */
+  TKeywords  /* ktable[key] is the word set; 'cap' is 1 to ignore case;
+               the set of word chars is stored in next CHARSETSIZE bytes */
 } TTag;
 
 
@@ -25,6 +25,9 @@
 #define PATTERN_T	"lpeg-pattern"
 #define MAXSTACKIDX	"lpeg-maxstack"
 
+/* registry key for the memo counters of a Lua state */
+#define MEMOSTATSIDX	"lpeg-memostats"
+
 
 /*
 ** compatibility with Lua 5.1
@@ -62,6 +65,12 @@
 
 
 
+/* number of entries in memo table (must be a power of 2) */
+#if !defined(MEMOSIZE)
+#define MEMOSIZE	1024
+#endif
+
+
 /* initial size for capture's list */
 #define INITCAPSIZE	32
 
@@ -78,8 +87,11 @@
 /* index, on Lua stack, for pattern's ktable */
 #define ktableidx(ptop)		((ptop) + 3)
 
+/* index, on Lua stack, for memo table (nil until first needed) */
+#define memoidx(ptop)	((ptop) + 4)
+
 /* index, on Lua stack, for backtracking stack */
-#define stackidx(ptop)	((ptop) + 4)
+#define stackidx(ptop)	((ptop) + 5)
 
 
 
@@ -106,6 +118,12 @@ typedef struct Charset {
 /* number of slots needed for 'n' bytes */
 #define bytes2slots(n)  (((n) - 1) / sizeof(TTree) + 1)
 
+/* ASCII lower-case version of byte 'c' */
+#define foldchar(c)	(('A' <= (c) && (c) <= 'Z') ? (c) - 'A' + 'a' : (c))
+
+/* ASCII upper-case version of lower-case letter 'c' */
+#define upperchar(c)	((c) - 'a' + 'A')
+
 /* set 'b' bit in charset 'cs' */
 #define setchar(cs,b)   ((cs)[(b) >> 3] |= (1 << ((b) & 7)))
 
@@ -126,6 +144,9 @@ typedef struct Charset {
 #define MAXBEHIND	MAXAUX
 
 
+/* maximum code point for utf ranges */
+#define MAXUTF		0x10FFFF
+
 /* maximum size (in elements) for a pattern */
 #define MAXPATTSIZE	(SHRT_MAX - 10)
 
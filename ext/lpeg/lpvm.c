@@ -34,6 +34,175 @@ static const Instruction giveup = {{IGiveup, 0, 0}};
 */
 
 
+/* ASCII case folding: maps upper-case letters to lower case */
+static const byte casefold[UCHAR_MAX + 1] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+  0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+  0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+  0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+  0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+  0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+  0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+  0x40, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67,  /* '@', 'A'-'G' */
+  0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,  /* 'H'-'O' */
+  0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77,  /* 'P'-'W' */
+  0x78, 0x79, 0x7a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,  /* 'X'-'Z', ... */
+  0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67,
+  0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+  0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77,
+  0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+  0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+  0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+  0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+  0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+  0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+  0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+  0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7,
+  0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,
+  0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+  0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+  0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7,
+  0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+  0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7,
+  0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
+  0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+  0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+
+
+/*
+** Decode one UTF-8 sequence starting at 's' into '*cp'; return the
+** position after it, or NULL if the sequence is invalid
+*/
+static const char *utf8decode (const char *s, const char *e, int *cp) {
+  static const unsigned int limits[] = {~0u, 0x80, 0x800, 0x10000u};
+  unsigned int c = (byte)s[0];
+  unsigned int res = 0;
+  int count = 0;
+  for (; c & 0x40; c <<= 1) {  /* while it needs continuation bytes... */
+    unsigned int cc;
+    if (s + count + 1 >= e) return NULL;
+    cc = (byte)s[++count];
+    if ((cc & 0xC0) != 0x80) return NULL;  /* not a continuation byte */
+    res = (res << 6) | (cc & 0x3F);
+  }
+  res |= ((c & 0x7F) << (count * 5));  /* add bits from first byte */
+  if (count > 3 || res > MAXUTF || res < limits[count])
+    return NULL;  /* invalid or overlong sequence */
+  *cp = (int)res;
+  return s + count + 1;
+}
+
+
+/*
+** {======================================================
+** Memo table
+** Direct-mapped: a new result for a slot evicts the old one, so
+** memory stays bounded by MEMOSIZE entries per match
+** =======================================================
+*/
+
+typedef struct MemoEntry {
+  int key;  /* memo id (0 for an empty entry) */
+  size_t pos;  /* subject position where pattern was tried */
+  size_t end;  /* position after the match (or MEMOFAIL) */
+} MemoEntry;
+
+#define MEMOFAIL	(~(size_t)0)
+
+
+/*
+** Get the memo counters of the Lua state, creating them if needed;
+** each state counts its own matches, so states running on different
+** threads never share them
+*/
+MemoStats *getmemostats (lua_State *L) {
+  MemoStats *stats;
+  lua_getfield(L, LUA_REGISTRYINDEX, MEMOSTATSIDX);
+  stats = (MemoStats *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  if (stats == NULL) {
+    stats = (MemoStats *)lua_newuserdata(L, sizeof(MemoStats));
+    memset(stats, 0, sizeof(MemoStats));
+    lua_setfield(L, LUA_REGISTRYINDEX, MEMOSTATSIDX);
+  }
+  return stats;
+}
+
+
+#define memoslot(memo,key,pos) \
+	(&(memo)[((pos) * 2654435761u + (size_t)(key) * 40503u) & (MEMOSIZE - 1)])
+
+
+/*
+** Get the memo table of the current match, creating it if needed
+*/
+static MemoEntry *getmemo (lua_State *L, int ptop) {
+  MemoEntry *memo = (MemoEntry *)lua_touserdata(L, memoidx(ptop));
+  if (memo == NULL) {
+    memo = (MemoEntry *)lua_newuserdata(L, MEMOSIZE * sizeof(MemoEntry));
+    memset(memo, 0, MEMOSIZE * sizeof(MemoEntry));
+    lua_replace(L, memoidx(ptop));
+  }
+  return memo;
+}
+
+
+static void memostore (MemoEntry *memo, MemoStats *stats, int key,
+                       size_t pos, size_t end) {
+  MemoEntry *entry = memoslot(memo, key, pos);
+  entry->key = key; entry->pos = pos; entry->end = end;
+  stats->stores++;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Keyword sets
+** =======================================================
+*/
+
+/* FNV-1a hash of 's', folding its letters to lower case if 'fold' */
+unsigned int keywordhash (const char *s, size_t len, int fold) {
+  unsigned int h = 2166136261u;
+  size_t i;
+  for (i = 0; i < len; i++)
+    h = (h ^ (fold ? casefold[(byte)s[i]] : (byte)s[i])) * 16777619u;
+  return h;
+}
+
+
+/*
+** Find word 's' (with hash 'h') in 'set': return its slot or, if the
+** word is not there, the empty slot where it would go. (Sets are never
+** more than half full, so there is always an empty slot.)
+*/
+KeywordSlot *findkeyword (const KeywordSet *set, unsigned int h,
+                          const char *s, size_t len, int fold) {
+  unsigned int i;
+  for (i = h; ; i++) {
+    const KeywordSlot *slot = &set->slot[i & set->mask];
+    if (slot->len == 0)
+      return (KeywordSlot *)slot;
+    if (slot->hash == h && slot->len == len) {
+      const byte *w = (const byte *)set + slot->offset;
+      size_t j = 0;
+      if (fold)
+        while (j < len && casefold[(byte)s[j]] == w[j]) j++;
+      else
+        while (j < len && (byte)s[j] == w[j]) j++;
+      if (j == len)
+        return (KeywordSlot *)slot;
+    }
+  }
+}
+
+/* }====================================================== */
+
+
 typedef struct Stack {
   const char *s;  /* saved position (or NULL for calls) */
   const Instruction *p;  /* next instruction */
@@ -148,6 +317,8 @@ static int removedyncap (lua_State *L, Capture *capture,
 */
 const char *match (lua_State *L, const char *o, const char *s, const char *e,
                    Instruction *op, Capture *capture, int ptop) {
+  MemoEntry *memo = NULL;  /* memo table (created on first use) */
+  MemoStats *memostats = NULL;  /* counters of the state (with 'memo') */
   Stack stackbase[INITBACK];
   Stack *stacklimit = stackbase + INITBACK;
   Stack *stack = stackbase;  /* point to first empty slot in stack */
@@ -222,6 +393,94 @@ const char *match (lua_State *L, const char *o, const char *s, const char *e,
         s -= n; p++;
         continue;
       }
+      case IMemo: {
+        size_t pos = s - o;
+        MemoEntry *entry;
+        if (memo == NULL) {
+          memo = getmemo(L, ptop);
+          memostats = getmemostats(L);
+        }
+        memostats->lookups++;
+        entry = memoslot(memo, p->i.key, pos);
+        if (entry->key == p->i.key && entry->pos == pos) {  /* known? */
+          memostats->hits++;
+          if (entry->end == MEMOFAIL) goto fail;
+          s = o + entry->end;
+          p += getoffset(p);
+          continue;
+        }
+        if (stack == stacklimit)
+          stack = doublestack(L, &stacklimit, ptop);
+        stack->p = p + getoffset(p) - 1;  /* IMemoFail */
+        stack->s = s;
+        stack->caplevel = captop;
+        stack++;
+        p += 2;
+        continue;
+      }
+      case IMemoCommit: {
+        assert(stack > getstackbase(L, ptop) && (stack - 1)->s != NULL);
+        stack--;
+        if (captop == stack->caplevel)  /* no captures to replay? */
+          memostore(memo, memostats, p->i.key, stack->s - o, s - o);
+        p += 2;  /* skip IMemoFail */
+        continue;
+      }
+      case IMemoFail: {  /* backtracked to where pattern was tried */
+        memostore(memo, memostats, p->i.key, s - o, MEMOFAIL);
+        goto fail;
+      }
+      case ICharI: {
+        if (casefold[(byte)*s] == p->i.aux && s < e)
+          { p++; s++; }
+        else goto fail;
+        continue;
+      }
+      case IUTFR: {
+        int c;
+        const char *next;
+        if (s >= e) goto fail;
+        if ((byte)*s < 0x80) {  /* ASCII? */
+          c = (byte)*s; next = s + 1;
+        }
+        else if ((next = utf8decode(s, e, &c)) == NULL)
+          goto fail;
+        if (c < (p + 1)->offset || c > (p + 2)->offset) goto fail;
+        s = next; p += 3;
+        continue;
+      }
+      case ILineStart: {
+        if (s > o && s[-1] != '\n' && s[-1] != '\r' && s[-1] != '\f')
+          goto fail;
+        p++;
+        continue;
+      }
+      case ILastChar: {
+        const char *b = s;
+        if (b > o) {
+          while (b > o && (b[-1] == ' ' || b[-1] == '\t' || b[-1] == '\r' ||
+                           b[-1] == '\n' || b[-1] == '\f'))
+            b--;
+          if (b == o || !testchar((p+1)->buff, (byte)b[-1]))
+            goto fail;
+        }
+        p += CHARSETINSTSIZE;
+        continue;
+      }
+      case IKeywords: {
+        const char *w = s;
+        const KeywordSet *set;
+        while (s < e && testchar((p+1)->buff, (byte)*s)) s++;
+        lua_rawgeti(L, ktableidx(ptop), p->i.key);
+        set = (const KeywordSet *)lua_touserdata(L, -1);
+        lua_pop(L, 1);  /* set is still anchored by the ktable */
+        if (s == w || (size_t)(s - w) > set->maxlen ||
+            findkeyword(set, keywordhash(w, s - w, p->i.aux), w, s - w,
+                        p->i.aux)->len == 0)
+          goto fail;
+        p += CHARSETINSTSIZE;
+        continue;
+      }
       case ISpan: {
         for (; s < e; s++) {
           int c = (byte)*s;
@@ -33,7 +33,16 @@ typedef enum Opcode {
   IFullCapture,  /* complete capture of last 'off' chars */
   IOpenCapture,  /* start a capture */
   ICloseCapture,
-  ICloseRunTime
+  ICloseRunTime,
+  ILineStart,  /* if not at subject start or after a line break, fail */
+  ILastChar,  /* if last non-space char not in buff, fail */
+  IUTFR,  /* if code point not in [offset, next offset], fail */
+  ICharI,  /* if folded char != aux, fail */
+  IMemo,  /* look up memo 'key': jump to 'offset' or fail if known,
+             else stack a choice to the following IMemoFail */
+  IMemoCommit,  /* pop choice, remember success of memo 'key', skip next */
+  IMemoFail,  /* remember failure of memo 'key' and fail */
+  IKeywords  /* span chars in buff; fail if span not in word set 'key' */
 } Opcode;
 
 
@@ -49,6 +58,41 @@ typedef union Instruction {
 } Instruction;
 
 
+/* instrumentation counters for memoized patterns, one set per Lua state */
+typedef struct MemoStats {
+  lua_Integer lookups;  /* memo instructions executed */
+  lua_Integer hits;  /* lookups answered by the memo table */
+  lua_Integer stores;  /* results stored in the memo table */
+} MemoStats;
+
+MemoStats *getmemostats (lua_State *L);
+
+
+/* a slot in the hash table of a keyword set */
+typedef struct KeywordSlot {
+  unsigned int hash;  /* hash of the word */
+  unsigned int len;  /* length of the word (0 for an empty slot) */
+  unsigned int offset;  /* position of the word from the start of the set */
+} KeywordSlot;
+
+/*
+** word set of a keywords pattern, kept as a userdata in the ktable;
+** words of sets that ignore case are stored in lower case
+*/
+typedef struct KeywordSet {
+  unsigned int mask;  /* number of slots minus 1 (a power of 2 minus 1) */
+  unsigned int maxlen;  /* length of the longest word */
+  KeywordSlot slot[1];  /* 'mask + 1' slots, followed by the words */
+} KeywordSet;
+
+#define keywordsetsize(nslots)  \
+	(sizeof(KeywordSet) + ((nslots) - 1) * sizeof(KeywordSlot))
+
+unsigned int keywordhash (const char *s, size_t len, int fold);
+KeywordSlot *findkeyword (const KeywordSet *set, unsigned int h,
+                          const char *s, size_t len, int fold);
+
+
 void printpatt (Instruction *p, int n);
 const char *match (lua_State *L, const char *o, const char *s, const char *e,
                    Instruction *op, Capture *capture, int ptop);
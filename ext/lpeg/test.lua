@@ -1161,6 +1161,210 @@ t = {p:match('abacc')}
 checkeq(t, {'a', 'aa', 20, 'a', 'aaa', 'aaa'})
 
 
+-- tests for line-start and last-char predicates
+do
+  local ls = m.linestart()
+  assert(ls:match("abc") == 1)    -- subject start
+  assert(ls:match("ab\ncd", 4) == 4)
+  assert(ls:match("ab\r\ncd", 5) == 5)
+  assert(ls:match("ab\rcd", 4) == 4)
+  assert(ls:match("ab\fcd", 4) == 4)
+  assert(not ls:match("abcd", 3))
+  assert(not ls:match("ab\n", 2))
+  -- init past the subject end is still after the last line break
+  assert(ls:match("ab\n", 10) == 4)
+  p = (m.linestart() * m.C"#" + 1)^0
+  checkeq({p:match("#a\n #b\n#c#")}, {"#", "#"})
+
+  local lc = m.lastchar("=(")
+  assert(lc:match("a", 1) == 1)    -- nothing before position 1
+  assert(lc:match("=a", 2) == 2)
+  assert(lc:match("( \t\n a", 6) == 6)    -- skips spaces
+  assert(not lc:match("x a", 3))
+  assert(not lc:match("   a", 4))    -- only spaces before
+  assert(lc:match("", 1) == 1)
+  -- a regex after an operator, a division after an operand
+  p = m.lastchar("=(") * m.C(m.P"/" * (1 - m.P"/")^0 * "/") + m.P"/" / "div"
+  assert(p:match("x = /re/", 5) == "/re/")
+  assert(p:match("x /re/", 3) == "div")
+  -- predicates do not consume and cannot be repeated
+  assert(m.match(m.linestart() * m.lastchar"x" * "a", "a") == 2)
+  checkerr("may accept empty string", function () return m.linestart()^0 end)
+end
+
+
+-- tests for UTF-8 ranges
+do
+  local u = m.utfR(0, 0x10FFFF)
+  assert(u:match("a") == 2)
+  assert(u:match("\xC3\xA9") == 3)    -- U+00E9
+  assert(u:match("\xE4\xB8\xAD") == 4)    -- U+4E2D
+  assert(u:match("\xF0\x9F\x98\x80") == 5)    -- U+1F600
+  assert(u:match("\xF4\x8F\xBF\xBF") == 5)    -- U+10FFFF
+  -- truncated sequences
+  assert(not u:match(""))
+  assert(not u:match("\xC3"))
+  assert(not u:match("\xE4\xB8"))
+  assert(not u:match("\xF0\x9F\x98"))
+  assert(not u:match("\xE4\x41\x41"))
+  assert(m.match(m.P"x" * u, "x\xE4\xB8") == nil)
+  -- overlong and invalid sequences
+  assert(not u:match("\xC0\x80"))
+  assert(not u:match("\xC1\xBF"))
+  assert(not u:match("\xE0\x9F\xBF"))
+  assert(not u:match("\xF0\x8F\xBF\xBF"))
+  assert(not u:match("\xF4\x90\x80\x80"))    -- beyond U+10FFFF
+  assert(not u:match("\x80"))    -- continuation byte
+  assert(not u:match("\xFF"))
+
+  -- range bounds
+  local cjk = m.utfR(0x4E00, 0x9FFF)
+  assert(cjk:match("\xE4\xB8\x80") == 4)    -- U+4E00
+  assert(cjk:match("\xE9\xBF\xBF") == 4)    -- U+9FFF
+  assert(not cjk:match("\xE3\xBF\xBF"))    -- U+3FFF
+  assert(not cjk:match("\xEA\x80\x80"))    -- U+A000
+  assert(not cjk:match("a"))
+  -- ranges crossing from ASCII into multi-byte sequences
+  local mixed = m.utfR(0x41, 0x3A9)
+  assert(mixed:match("A") == 2 and mixed:match("\xCE\xA9") == 3)
+  assert(not mixed:match("@") and not mixed:match("\xCE\xAA"))
+  -- ASCII ranges are plain charsets
+  eqcharset(m.utfR(0x61, 0x7A), m.R"az")
+
+  -- first sets of choices come from lead bytes
+  p = m.C(cjk^1) + m.C(m.utfR(0xE9, 0xFF)) + m.C(m.R"az"^1)
+  assert(p:match("\xE4\xB8\xAD\xE6\x96\x87x") == "\xE4\xB8\xAD\xE6\x96\x87")
+  assert(p:match("\xC3\xA9t\xC3\xA9") == "\xC3\xA9")
+  assert(p:match("abc\xC3\xA9") == "abc")
+  -- fixed length when both ends have encodings of the same length
+  assert(m.match(m.B(m.utfR(0x80, 0x7FF)) * "x", "\xC3\xA9x", 3) == 4)
+  checkerr("pattern may not have fixed length", m.B, m.utfR(0x7F, 0x80))
+  checkerr("code point out of range", m.utfR, -1, 10)
+  checkerr("code point out of range", m.utfR, 10, 0x110000)
+  checkerr("code point out of range", m.utfR, 20, 10)
+end
+
+
+-- tests for case-insensitive literals, lower-case captures and keywords
+do
+  p = m.Pi"Select"
+  assert(p:match("select") == 7 and p:match("SELECT") == 7)
+  assert(p:match("sElEcTed") == 7)
+  assert(not p:match("selec") and not p:match("delete"))
+  assert(m.Pi"":match("x") == 1)
+  assert(m.Pi"a-1":match("A-1") == 4 and not m.Pi"a-1":match("A_1"))
+  assert(not m.Pi"\xE9":match("\xC9"))    -- only ASCII letters fold
+  -- first sets include both cases
+  assert((m.Pi"if" + m.R"AZ"):match("IF") == 3)
+  assert((m.Pi"if" + m.R"AZ"):match("Ix") == 2)
+  assert((m.Pi"abc" + m.P"Abd"):match("Abd") == 4)
+  assert(not ((m.P"x" + m.Pi"y")^1 * -1):match("xYyX"))
+  assert(((m.P"x" + m.Pi"y")^1 * -1):match("xYyx") == 5)
+  p = m.P{ m.Pi"begin" * (m.V(1) + (1 - m.Pi"end"))^0 * m.Pi"end" }
+  assert(p:match("BEGIN x Begin y END end") == 24)
+
+  assert(m.match(m.Cl(m.P"AbC"), "AbC") == "abc")
+  assert(m.match(m.Cl(m.Pi"abc"), "ABC") == "abc")
+  -- nested values are ignored; the whole match is lowered
+  assert(m.match(m.Cl(m.C"AB" * m.C"c"), "ABc") == "abc")
+  assert(m.match(m.Cl(m.Cg(m.C"A", "x") * m.Cb"x"), "AB") == "a")
+  checkeq(m.match(m.Ct(m.Cl(m.C"AB" * m.Cc(1)) * m.C"D"), "ABD"), {"ab", "D"})
+  assert(m.match(m.Cs(m.Cl(m.P"AB") * (m.P"C" / "z")), "ABC") == "abz")
+  assert(m.match(m.Cs(m.Cl(m.P"A" * (m.P"B" / "Z"))), "ABC") == "ab")
+  assert(m.match(m.Cl(m.P""), "A") == "")
+
+  local letters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_"
+  local kw = m.keywords({"SELECT", "from", "Where", "from", ""}, letters, true)
+  assert(kw:match("select") == 7 and kw:match("SeLeCt x") == 7)
+  assert(kw:match("FROM") == 5 and kw:match("where") == 6)
+  assert(not kw:match("selects") and not kw:match("sel"))    -- whole runs
+  assert(not kw:match("") and not kw:match(" select"))
+  local cs = m.keywords({"If", "then"}, letters)
+  assert(cs:match("If") == 3 and not cs:match("if") and not cs:match("IF"))
+  assert(cs:match("then(") == 5 and not cs:match("then_"))
+  assert(m.keywords({"a-b"}, "ab-"):match("a-b c") == 4)
+  assert(not m.keywords({"a-b"}, "ab"):match("a-b"))    -- '-' is no word char
+  assert(not m.keywords({}, "a"):match("a"))
+  -- first sets and ktables of combined patterns
+  assert((kw + m.R"AZ"):match("FROMX") == 2)
+  assert((m.keywords({"if"}, letters, true) + m.R"AZ"):match("IF") == 3)
+  p = m.Cc"k" * kw + m.Cc"c" * cs + m.Cc"-" * 1
+  checkeq({((m.C(p) * " ")^0):match("where If x ")},
+          {"where", "k", "If", "c", "x", "-"})
+  p = m.P{ (m.V"k" + 1)^0 * -1, k = m.C(kw) }
+  checkeq({p:match("x select, from;")}, {"select", "from"})
+  checkerr("list of strings expected", m.keywords, {"a", 1}, "a")
+  checkerr("table expected", m.keywords, "a", "a")
+end
+
+
+-- tests for memoized patterns
+do
+  local function stats (...) return {...} end
+  local g = m.P{ m.V"r" * "x" + m.V"r" * "y", r = m.M(m.P"a"^1 * "b") }
+  m.memostats(true)
+  -- second try of 'r' at position 1 is a hit
+  assert(g:match("aaby") == 5)
+  checkeq(stats(m.memostats()), {2, 1, 1})
+  checkeq(stats(m.memostats(true)), {2, 1, 1})    -- reset after reading
+  checkeq(stats(m.memostats()), {0, 0, 0})
+  -- failures are remembered too
+  assert(not g:match("aac"))
+  checkeq(stats(m.memostats(true)), {2, 1, 1})
+  -- each match starts with an empty memo
+  assert(g:match("aabx") == 5 and g:match("aabx") == 5)
+  checkeq(stats(m.memostats(true)), {2, 0, 2})
+
+  -- matches with captures are not stored, so their values are redone
+  local gc = m.P{ m.V"r" * "x" + m.V"r" * "y", r = m.M(m.C(m.P"a"^1)) }
+  assert(gc:match("aay") == "aa")
+  checkeq(stats(m.memostats(true)), {2, 0, 0})
+  gc = m.P{ m.V"r" * "x" + m.V"r" * "y", r = m.M(m.P"a"^1) * m.Cp() }
+  assert(gc:match("aay") == 3)
+  checkeq(stats(m.memostats(true)), {2, 1, 1})
+
+  -- backtracking through memoized rules gives the same results
+  local function grammar (M)
+    return m.P{ "s",
+      s = m.Ct((m.V"e" * ";" + m.C(1))^0),
+      e = M(m.V"t" * "+" * m.V"e" + m.V"t" * "-" * m.V"e" + m.V"t"),
+      t = M(m.C(m.R"09"^1) + "(" * m.V"e" * ")"),
+    }
+  end
+  local plain, memo = grammar(function (p) return p end), grammar(m.M)
+  for _, s in ipairs{"1+2;", "1+(2-3)+x;", "((1));(2", "1+2-3-;", "", "+;"} do
+    checkeq(memo:match(s), plain:match(s))
+  end
+  -- results survive eviction of old entries
+  p = m.P{ ((m.V"r" * "x" + m.V"r" * "y" + 1) * m.Cp())^0, r = m.M(m.P"a"^1) }
+  m.memostats(true)
+  local res = {p:match(string.rep("ay", 3000))}
+  assert(#res == 3000 and res[3000] == 6001)
+  local lookups, hits = m.memostats(true)
+  assert(lookups == 6000 and hits == 3000)
+
+  checkerr("may accept empty string", function () return m.M(m.P"a"^0)^0 end)
+  assert(m.match(m.M(m.P"a"^0), "b") == 1)
+end
+
+
+-- tests for footprint
+do
+  local nt, nc, nk, size = m.footprint(m.P"abc")
+  assert(nt == 5 and nc > 0 and nk == 0)
+  assert(size >= nt + nc)    -- bytes of tree nodes plus instructions
+  local nt2, nc2, nk2, size2 = m.footprint(m.P"abc" * m.Cc(1, 2) + m.Cb"x")
+  assert(nt2 > nt and nc2 > nc and nk2 == 3 and size2 > size)
+  p = m.P"a"^1
+  local _, _, _, s1 = m.footprint(p)
+  local _, _, _, s2 = m.footprint(p)    -- compiled only once
+  assert(s1 == s2)
+  p = m.P{ m.V"a" * m.V"b", a = m.P"a", b = m.P"b" }
+  assert(select(3, m.footprint(p)) == 3)    -- initial rule and two names
+  assert(p:match("ab") == 3)
+end
+
+
 -------------------------------------------------------------------
 -- Tests for 're' module
 -------------------------------------------------------------------
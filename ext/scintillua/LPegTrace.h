@@ -0,0 +1,135 @@
+/**
+ * Copyright 2006-2017 Mitchell mitchell.att.foicica.com.
+ * This file is distributed under Scintilla's license.
+ *
+ * A ring buffer of timed events, shared by the LPeg lexer and the
+ * applications that host it, written out in the Chrome trace event format
+ * that trace viewers like chrome://tracing and Perfetto load.
+ */
+
+#ifndef LPEGTRACE_H
+#define LPEGTRACE_H
+
+#include <stdio.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** A span of time a thread spent on something. */
+struct LPegTraceEvent {
+	/** What the time was spent on. It must be a string literal. */
+	const char *name;
+	/** The component that spent the time. It must be a string literal. */
+	const char *category;
+	/** The start of the span, in milliseconds of `LPegTrace::Now()`. */
+	double start;
+	/** The length of the span in milliseconds. */
+	double duration;
+	/** The thread that spent the time. */
+	unsigned int thread;
+};
+
+/**
+ * The most recent events, oldest overwritten first.
+ * Recording an event takes no lock and allocates nothing, but the ring is not
+ * lock-free: it is a single-writer ring without atomics. Only the thread that
+ * owns a trace may record events in it, so no caller records events from
+ * background job or warm-up threads; spans of those threads are recorded on
+ * their behalf by the owning thread, once they end.
+ */
+class LPegTrace {
+	/** The ring of events. */
+	std::vector<LPegTraceEvent> events;
+	/** The number of events recorded since the ring was sized. */
+	size_t count;
+
+public:
+	LPegTrace() : count(0) {}
+
+	/**
+	 * Keeps the last *size* events from now on, or none if *size* is `0`.
+	 * Events recorded so far are dropped.
+	 */
+	void Resize(size_t size) {
+		events.assign(size, LPegTraceEvent());
+		count = 0;
+	}
+
+	/** Returns the number of events kept. */
+	size_t Size() const { return events.size(); }
+
+	/** Returns whether or not events are recorded. */
+	bool Enabled() const { return !events.empty(); }
+
+	/**
+	 * Records a span of thread *thread* from *start* up to *end*, overwriting
+	 * the oldest event if the ring is full.
+	 */
+	void Add(const char *name, const char *category, double start, double end,
+	         unsigned int thread = CurrentThread()) {
+		if (events.empty()) return;
+		LPegTraceEvent &event = events[count++ % events.size()];
+		event.name = name, event.category = category;
+		event.start = start, event.duration = end - start;
+		event.thread = thread;
+	}
+
+	/**
+	 * Returns the events, oldest first, as comma-separated Chrome trace event
+	 * objects, so traces from several sources can be joined into one
+	 * "traceEvents" array.
+	 */
+	std::string Json() const {
+		std::string json;
+		size_t n = count < events.size() ? count : events.size();
+		char line[256];
+		for (size_t i = count - n; i < count; i++) {
+			const LPegTraceEvent &event = events[i % events.size()];
+			snprintf(line, sizeof(line),
+			         "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+			         "\"dur\":%.3f,\"pid\":1,\"tid\":%u}\n", json.empty() ? "" : ",",
+			         event.name, event.category, event.start * 1000,
+			         event.duration * 1000, event.thread);
+			json += line;
+		}
+		return json;
+	}
+
+	/**
+	 * Returns the current time in milliseconds. The clock is the same in every
+	 * module of a process, so their events line up.
+	 */
+	static double Now() {
+		using namespace std::chrono;
+		return duration<double, std::milli>(
+			steady_clock::now().time_since_epoch()).count();
+	}
+
+	/** Returns the number trace events identify the calling thread by. */
+	static unsigned int CurrentThread() {
+		return static_cast<unsigned int>(
+			std::hash<std::thread::id>()(std::this_thread::get_id()) & 0x7fffffff);
+	}
+};
+
+/**
+ * Records the time from its construction to its destruction as an event, if
+ * it was given a trace that is enabled.
+ */
+class LPegTraceScope {
+	LPegTrace *trace;
+	const char *name, *category;
+	double start;
+
+public:
+	LPegTraceScope(LPegTrace *trace, const char *name, const char *category) :
+		trace(trace && trace->Enabled() ? trace : NULL), name(name),
+		category(category), start(this->trace ? LPegTrace::Now() : 0) {}
+	~LPegTraceScope() {
+		if (trace) trace->Add(name, category, start, LPegTrace::Now());
+	}
+};
+
+#endif
@@ -15,6 +15,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #if CURSES
 #include <curses.h>
 #endif
@@ -26,6 +39,8 @@
 #include "PropSetSimple.h"
 #include "LexAccessor.h"
 #include "LexerModule.h"
+#include "LexLPeg.h"
+#include "LPegTrace.h"
 
 extern "C" {
 #include "lua.h"
@@ -76,6 +91,632 @@ using namespace Scintilla;
 #define l_setfunction(l, f, k) (lua_pushcfunction(l, f), lua_setfield(l, -2, k))
 #define l_setconstant(l, c, k) (lua_pushinteger(l, c), lua_setfield(l, -2, k))
 
+/** Returns a monotonic timestamp in milliseconds. */
+static double l_clock() {
+	using namespace std::chrono;
+	return duration<double, std::milli>(
+		steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Returns the number of milliseconds since *mark* and moves *mark* to the
+ * current time.
+ */
+static double l_lap(double &mark) {
+	double now = l_clock(), lap = now - mark;
+	mark = now;
+	return lap;
+}
+
+/** Returns the number of bytes of memory in use by Lua state *L*. */
+static long long l_memory(lua_State *L) {
+	return lua_gc(L, LUA_GCCOUNT, 0) * 1024LL + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+/**
+ * The size of the chunks a `l_Region` hands out blocks from, and the largest
+ * block it hands out. Larger blocks come from `malloc()`.
+ */
+#define REGION_CHUNKSIZE (256 * 1024)
+#define REGION_MAXBLOCK (REGION_CHUNKSIZE / 16)
+/** The number of empty chunks a `l_Region` keeps around for reuse. */
+#define REGION_MAXFREE 4
+/**
+ * The most bytes a `l_Region` holds in chunks, including chunks that objects
+ * still in use pin. Once it holds this many, new blocks come from `malloc()`
+ * until a chunk empties.
+ */
+#define REGION_MAXSIZE (32 * REGION_CHUNKSIZE)
+
+/**
+ * A chunk of region memory. Blocks are bumped from its start and the chunk is
+ * recycled as a whole once Lua has freed all of them.
+ */
+struct l_RegionChunk {
+	l_RegionChunk *next; // next empty chunk
+	size_t used; // bytes handed out, including the chunk header
+	size_t live; // number of blocks Lua has not freed yet
+};
+
+/**
+ * The header preceding every block handed to Lua.
+ * It is sized to keep blocks aligned for any Lua object.
+ */
+union l_BlockHeader {
+	l_RegionChunk *chunk; // owning chunk, or NULL for blocks from `malloc()`
+	long double align;
+	char pad[16];
+};
+
+#define REGION_ALIGN(n) (((n) + sizeof(l_BlockHeader) - 1) & \
+                         ~(sizeof(l_BlockHeader) - 1))
+#define REGION_START REGION_ALIGN(sizeof(l_RegionChunk))
+
+/**
+ * The scratch region for the allocations a Lua state makes while lexing or
+ * folding.
+ * This is not a region that is reset when the call returns: it is a bump
+ * allocator whose chunks count their live blocks. Almost everything allocated
+ * during one of those calls is garbage once it returns, so those blocks are
+ * bumped from chunks instead of being allocated one by one, and a chunk is
+ * reused once the collector has freed all of its blocks. Objects that escape
+ * the call (e.g. into the registry) pin their chunk until Lua frees them, so
+ * the chunks are bounded by `REGION_MAXSIZE`.
+ */
+struct l_Region {
+	bool active; // whether new blocks come from the region
+	l_RegionChunk *current; // chunk new blocks are bumped from
+	l_RegionChunk *empty; // empty chunks kept for reuse
+	int nempty; // the number of chunks in `empty`
+	size_t size; // bytes held in chunks
+};
+
+/** Returns block *ptr* to region *r* or frees it. */
+static void l_release(l_Region *r, void *ptr) {
+	l_BlockHeader *header = static_cast<l_BlockHeader *>(ptr) - 1;
+	l_RegionChunk *chunk = header->chunk;
+	if (!chunk) return free(header);
+	if (--chunk->live > 0) return;
+	if (chunk == r->current)
+		chunk->used = REGION_START;
+	else if (r->nempty < REGION_MAXFREE)
+		chunk->next = r->empty, r->empty = chunk, r->nempty++;
+	else
+		free(chunk), r->size -= REGION_CHUNKSIZE;
+}
+
+/**
+ * Returns a block of *n* bytes from region *r* if it is active, the block is
+ * small enough, and the region has room for it, or from `malloc()` otherwise.
+ */
+static void *l_acquire(l_Region *r, size_t n) {
+	size_t total = REGION_ALIGN(n + sizeof(l_BlockHeader));
+	l_BlockHeader *header = NULL;
+	if (r->active && total <= REGION_MAXBLOCK) {
+		l_RegionChunk *chunk = r->current;
+		if (!chunk || chunk->used + total > REGION_CHUNKSIZE) {
+			// A retired chunk that still has live blocks is recycled by
+			// `l_release()` once Lua frees the last of them.
+			if (r->empty)
+				chunk = r->empty, r->empty = chunk->next, r->nempty--;
+			else if (r->size + REGION_CHUNKSIZE <= REGION_MAXSIZE &&
+			         (chunk = static_cast<l_RegionChunk *>(
+			          malloc(REGION_CHUNKSIZE))))
+				r->size += REGION_CHUNKSIZE;
+			else
+				chunk = NULL; // too many chunks are pinned
+			if (chunk)
+				chunk->used = REGION_START, chunk->live = 0, r->current = chunk;
+		}
+		if (chunk) {
+			header = reinterpret_cast<l_BlockHeader *>(
+				reinterpret_cast<char *>(chunk) + chunk->used);
+			chunk->used += total, chunk->live++;
+			header->chunk = chunk;
+		}
+	}
+	if (!header) {
+		if (!(header = static_cast<l_BlockHeader *>(
+		      malloc(n + sizeof(l_BlockHeader))))) return NULL;
+		header->chunk = NULL;
+	}
+	return header + 1;
+}
+
+/** Frees all empty chunks of region *r*. */
+static void l_freeregion(l_Region *r) {
+	if (r->current && r->current->live == 0)
+		r->current->next = r->empty, r->empty = r->current, r->current = NULL;
+	while (r->empty) {
+		l_RegionChunk *next = r->empty->next;
+		free(r->empty), r->size -= REGION_CHUNKSIZE;
+		r->empty = next;
+	}
+	r->nempty = 0;
+}
+
+/** The `lua_Alloc` function for Lua states with a `l_Region`. */
+static void *l_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	l_Region *r = static_cast<l_Region *>(ud);
+	if (nsize == 0) {
+		if (ptr) l_release(r, ptr);
+		return NULL;
+	} else if (!ptr)
+		return l_acquire(r, nsize);
+	l_BlockHeader *header = static_cast<l_BlockHeader *>(ptr) - 1;
+	if (!header->chunk) {
+		// Blocks from `malloc()` stay there; `realloc()` is cheap for them.
+		header = static_cast<l_BlockHeader *>(
+			realloc(header, nsize + sizeof(l_BlockHeader)));
+		return header ? header + 1 : NULL;
+	} else if (nsize <= osize)
+		return ptr; // shrink in place
+	void *block = l_acquire(r, nsize);
+	if (!block) return NULL;
+	memcpy(block, ptr, osize);
+	l_release(r, ptr);
+	return block;
+}
+
+/** The longest line, in bytes, whose style runs are cached. */
+#define LINECACHE_MAXLINE 512
+
+/** A line lexed by a line lexer and the style runs it lexed to. */
+struct l_CachedLine {
+	unsigned long long hash; // hash of `text`
+	std::string text;
+	std::vector<std::pair<Sci_PositionU, int>> runs; // (end offset, style) pairs
+};
+
+/** Returns the 64-bit FNV-1a hash of the *len* bytes at *s*. */
+static unsigned long long l_hash(const char *s, size_t len) {
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ static_cast<unsigned char>(s[i])) * 1099511628211ULL;
+	return hash;
+}
+
+/** The number of bytes a background thread lexes between progress reports. */
+#define BACKGROUND_CHUNKSIZE (256 * 1024)
+/**
+ * The most bytes a single background job copies out of the document. Longer
+ * ranges are lexed by a chain of jobs, which bounds the memory held by copies.
+ */
+#define BACKGROUND_MAXJOB (16 * 1024 * 1024)
+/** The fewest bytes a background job lexes on an extra thread. */
+#define BACKGROUND_MINSEGMENT (1024 * 1024)
+/**
+ * The most bytes of a range lexed at once. Larger ranges are lexed in windows
+ * of this size.
+ */
+#define LEX_WINDOW (1024 * 1024)
+/**
+ * The number of bytes at the end of a window whose tokens are lexed again with
+ * the next window.
+ */
+#define LEX_WINDOWMARGIN (64 * 1024)
+/** The number of bytes a time-sliced lex call lexes before timing itself. */
+#define SLICE_FIRSTPIECE (4 * 1024)
+
+/**
+ * A copy of part of a document for a background thread to lex and fold, and
+ * the styles, fold levels, and line states produced for it.
+ * Positions and lines are relative to the start of the copy. The thread writes
+ * results while holding `lock`, which the owning lexer holds while reading
+ * them.
+ */
+class l_Snapshot : public IDocument {
+public:
+	std::string text;
+	std::vector<char> styles;
+	/** The start position of each line in `text`. */
+	std::vector<Sci_Position> lines;
+	std::vector<int> levels;
+	std::vector<int> line_states;
+	/** Whether or not the lexer set any line states. */
+	bool line_states_set;
+	/** The lowest line whose fold level changed since it was last read. */
+	Sci_Position level_low;
+	/** The indentation of the first line, which may only be partly copied. */
+	int first_indent;
+	int tab_width;
+	int code_page;
+	/** The position `SetStyleFor()` and `SetStyles()` style from. */
+	Sci_Position styling_pos;
+	std::mutex lock;
+
+	l_Snapshot() : line_states_set(false), level_low(0), first_indent(0),
+	               tab_width(8), code_page(0), styling_pos(0) {}
+
+	/** Finds the start of each line in `text`. */
+	void FindLines() {
+		lines.assign(1, 0);
+		for (size_t i = 0; i < text.size(); i++)
+			if (text[i] == '\n' || (text[i] == '\r' &&
+			    (i + 1 == text.size() || text[i + 1] != '\n')))
+				lines.push_back(i + 1);
+		line_states.assign(lines.size(), 0);
+		levels.resize(lines.size(), SC_FOLDLEVELBASE);
+		level_low = lines.size();
+	}
+
+	int SCI_METHOD Version() const { return dvOriginal; }
+	void SCI_METHOD SetErrorStatus(int) {}
+	Sci_Position SCI_METHOD Length() const { return text.size(); }
+	void SCI_METHOD GetCharRange(char *buffer, Sci_Position position,
+	                             Sci_Position lengthRetrieve) const {
+		text.copy(buffer, lengthRetrieve, position);
+	}
+	char SCI_METHOD StyleAt(Sci_Position position) const {
+		return (position >= 0 && position < Length()) ? styles[position] : 0;
+	}
+	Sci_Position SCI_METHOD LineFromPosition(Sci_Position position) const {
+		return std::upper_bound(lines.begin(), lines.end(), position) -
+		       lines.begin() - 1;
+	}
+	Sci_Position SCI_METHOD LineStart(Sci_Position line) const {
+		if (line < 0) return 0;
+		return (line < static_cast<Sci_Position>(lines.size())) ? lines[line] :
+		       Length();
+	}
+	int SCI_METHOD GetLevel(Sci_Position line) const {
+		return (line >= 0 && line < static_cast<Sci_Position>(lines.size())) ?
+		       levels[line] : SC_FOLDLEVELBASE;
+	}
+	int SCI_METHOD SetLevel(Sci_Position line, int level) {
+		if (line < 0 || line >= static_cast<Sci_Position>(lines.size()))
+			return SC_FOLDLEVELBASE;
+		std::lock_guard<std::mutex> guard(lock);
+		int previous = levels[line];
+		levels[line] = level;
+		if (line < level_low) level_low = line;
+		return previous;
+	}
+	int SCI_METHOD GetLineState(Sci_Position line) const {
+		return (line >= 0 && line < static_cast<Sci_Position>(lines.size())) ?
+		       line_states[line] : 0;
+	}
+	int SCI_METHOD SetLineState(Sci_Position line, int state) {
+		if (line < 0 || line >= static_cast<Sci_Position>(lines.size())) return 0;
+		std::lock_guard<std::mutex> guard(lock);
+		int previous = line_states[line];
+		line_states[line] = state, line_states_set = true;
+		return previous;
+	}
+	void SCI_METHOD StartStyling(Sci_Position position, char) {
+		styling_pos = position;
+	}
+	bool SCI_METHOD SetStyleFor(Sci_Position length, char style) {
+		if (styling_pos + length > Length()) return false;
+		std::lock_guard<std::mutex> guard(lock);
+		memset(&styles[styling_pos], style, length), styling_pos += length;
+		return true;
+	}
+	bool SCI_METHOD SetStyles(Sci_Position length, const char *styles_) {
+		if (styling_pos + length > Length()) return false;
+		std::lock_guard<std::mutex> guard(lock);
+		memcpy(&styles[styling_pos], styles_, length), styling_pos += length;
+		return true;
+	}
+	void SCI_METHOD DecorationSetCurrentIndicator(int) {}
+	void SCI_METHOD DecorationFillRange(Sci_Position, int, Sci_Position) {}
+	void SCI_METHOD ChangeLexerState(Sci_Position, Sci_Position) {}
+	int SCI_METHOD CodePage() const { return code_page; }
+	bool SCI_METHOD IsDBCSLeadByte(char) const { return false; }
+	const char * SCI_METHOD BufferPointer() { return text.c_str(); }
+	int SCI_METHOD GetLineIndentation(Sci_Position line) {
+		if (line <= 0) return first_indent;
+		int indent = 0;
+		for (Sci_Position i = LineStart(line); i < Length(); i++)
+			if (text[i] == ' ')
+				indent++;
+			else if (text[i] == '\t')
+				indent = (indent / tab_width + 1) * tab_width;
+			else
+				break;
+		return indent;
+	}
+};
+
+/**
+ * A range of a document being lexed by a background thread.
+ * The thread lexes and folds `doc` in chunks that end at line starts,
+ * publishing the end of each chunk in `ready`. The lexer that started the job
+ * applies the results before `ready` to the document, up to `merged`.
+ */
+struct l_Job {
+	l_Snapshot doc;
+	/** The document position of the start of `doc`. */
+	Sci_PositionU start;
+	/** The document line of the start of `doc`. */
+	Sci_Position first_line;
+	/** The style at the start of `doc`. */
+	int init_style;
+	/** Whether or not the lexer is a line lexer. */
+	bool by_line;
+	/** The most threads to lex `doc` with. */
+	int threads;
+	/** The style of the lexer's own whitespace. */
+	int whitespace;
+	/** The properties of the lexer that started the job. */
+	std::vector<std::pair<std::string, std::string>> props;
+	/** The token names and style numbers of the lexer that started the job. */
+	std::vector<std::pair<std::string, int>> styles;
+	/** The number of bytes of `doc` lexed so far. */
+	std::atomic<size_t> ready;
+	/** The number of bytes of `doc` whose styles were applied. */
+	size_t merged;
+	/**
+	 * The position in `doc` to fold from. Lines before it were already folded
+	 * in the document.
+	 */
+	size_t fold_from;
+	/** Whether or not the thread should stop after its current chunk. */
+	std::atomic<bool> cancel;
+	/** Whether or not the thread finished. */
+	std::atomic<bool> done;
+	std::thread thread;
+	/** When the thread started and finished, for the trace. */
+	double started, finished;
+	/** The trace's number for the thread. */
+	unsigned int thread_id;
+
+	l_Job() : start(0), first_line(0), init_style(0), by_line(false),
+	          threads(1), whitespace(0), ready(0), merged(0), fold_from(0),
+	          cancel(false), done(false), started(0), finished(0),
+	          thread_id(0) {}
+};
+
+/**
+ * A part of a background job's snapshot lexed ahead on an extra thread.
+ * The thread guesses that no token spans the start of the part, which the
+ * job checks once it has lexed everything before the part. Segments start
+ * after blank lines, where that is likely.
+ */
+struct l_Segment {
+	l_Snapshot doc;
+	/** The position in the job's snapshot `doc` starts at. */
+	size_t start;
+	/** The style the thread assumed the job's snapshot has before `start`. */
+	int init_style;
+	/** Whether or not the thread lexed all of `doc`. */
+	bool lexed;
+	std::thread thread;
+
+	l_Segment() : start(0), init_style(0), lexed(false) {}
+};
+
+/** The style attributes a style property can set. */
+enum l_StyleAttribute {
+	SA_FONT, SA_SIZE, SA_WEIGHT, SA_ITALIC, SA_UNDERLINE, SA_FORE, SA_BACK,
+	SA_EOLFILLED, SA_CHARACTERSET, SA_CASE, SA_VISIBLE, SA_CHANGEABLE,
+	SA_HOTSPOT, SA_COUNT
+};
+
+/** The Scintilla messages that get and set each `l_StyleAttribute`. */
+static const int l_style_get[SA_COUNT] = {
+	SCI_STYLEGETFONT, SCI_STYLEGETSIZE, SCI_STYLEGETWEIGHT, SCI_STYLEGETITALIC,
+	SCI_STYLEGETUNDERLINE, SCI_STYLEGETFORE, SCI_STYLEGETBACK,
+	SCI_STYLEGETEOLFILLED, SCI_STYLEGETCHARACTERSET, SCI_STYLEGETCASE,
+	SCI_STYLEGETVISIBLE, SCI_STYLEGETCHANGEABLE, SCI_STYLEGETHOTSPOT
+};
+static const int l_style_set[SA_COUNT] = {
+	SCI_STYLESETFONT, SCI_STYLESETSIZE, SCI_STYLESETWEIGHT, SCI_STYLESETITALIC,
+	SCI_STYLESETUNDERLINE, SCI_STYLESETFORE, SCI_STYLESETBACK,
+	SCI_STYLESETEOLFILLED, SCI_STYLESETCHARACTERSET, SCI_STYLESETCASE,
+	SCI_STYLESETVISIBLE, SCI_STYLESETCHANGEABLE, SCI_STYLESETHOTSPOT
+};
+
+/** The attributes of a style, as parsed from a style property. */
+struct l_Style {
+	/** Bit *i* is set if attribute *i* has a value. */
+	unsigned int set;
+	/** The value of each attribute but `SA_FONT`. */
+	int values[SA_COUNT];
+	/** The value of `SA_FONT`. */
+	std::string font;
+
+	l_Style() : set(0), values() {}
+
+	/** Returns whether or not attribute *attr* has a value. */
+	bool Has(int attr) const { return (set & (1 << attr)) != 0; }
+	/** Gives attribute *attr* value *value*. */
+	void Set(int attr, int value) { set |= 1 << attr, values[attr] = value; }
+	/** Gives the attributes *style* has values for those values. */
+	void Overlay(const l_Style &style) {
+		for (int attr = 0; attr < SA_COUNT; attr++)
+			if (style.Has(attr)) Set(attr, style.values[attr]);
+		if (style.Has(SA_FONT)) font = style.font;
+	}
+};
+
+/**
+ * Parses style property *style*, like "fore:#FF0000,bold", into *out*, the
+ * way `LexerLPeg::SetStyle()` applies it.
+ */
+static void l_parsestyle(const char *style, l_Style *out) {
+	std::string copy(style);
+	char *option = &copy[0], *next = NULL, *p = NULL;
+	while (option) {
+		if ((next = strchr(option, ','))) *next++ = '\0';
+		if ((p = strchr(option, ':'))) *p++ = '\0';
+		if (streq(option, "font") && p)
+			out->Set(SA_FONT, 0), out->font = p;
+		else if (streq(option, "size") && p)
+			out->Set(SA_SIZE, atoi(p));
+		else if (streq(option, "bold") || streq(option, "notbold") ||
+		         streq(option, "weight"))
+			out->Set(SA_WEIGHT, *option == 'b' ? SC_WEIGHT_BOLD :
+			                    *option == 'w' && p ? atoi(p) : SC_WEIGHT_NORMAL);
+		else if (streq(option, "italics") || streq(option, "notitalics"))
+			out->Set(SA_ITALIC, *option == 'i');
+		else if (streq(option, "underlined") || streq(option, "notunderlined"))
+			out->Set(SA_UNDERLINE, *option == 'u');
+		else if ((streq(option, "fore") || streq(option, "back")) && p) {
+			int color = static_cast<int>(strtol(p, NULL, 0));
+			if (*p == '#') { // #RRGGBB format; Scintilla format is 0xBBGGRR
+				color = static_cast<int>(strtol(p + 1, NULL, 16));
+				color = ((color & 0xFF0000) >> 16) | (color & 0xFF00) |
+				        ((color & 0xFF) << 16); // convert to 0xBBGGRR
+			}
+			out->Set(*option == 'f' ? SA_FORE : SA_BACK, color);
+		} else if (streq(option, "eolfilled") || streq(option, "noteolfilled"))
+			out->Set(SA_EOLFILLED, *option == 'e');
+		else if (streq(option, "characterset") && p)
+			out->Set(SA_CHARACTERSET, atoi(p));
+		else if (streq(option, "case") && p) {
+			if (*p == 'u')
+				out->Set(SA_CASE, SC_CASE_UPPER);
+			else if (*p == 'l')
+				out->Set(SA_CASE, SC_CASE_LOWER);
+		} else if (streq(option, "visible") || streq(option, "notvisible"))
+			out->Set(SA_VISIBLE, *option == 'v');
+		else if (streq(option, "changeable") || streq(option, "notchangeable"))
+			out->Set(SA_CHANGEABLE, *option == 'c');
+		else if (streq(option, "hotspot") || streq(option, "nothotspot"))
+			out->Set(SA_HOTSPOT, *option == 'h');
+		option = next;
+	}
+}
+
+/** The parsed styles of a lexer's tokens with a theme and properties. */
+struct l_StyleTable {
+	/** The style of `STYLE_DEFAULT`. */
+	l_Style default_style;
+	/** The styles of the other tokens, by token name. */
+	std::unordered_map<std::string, l_Style> styles;
+};
+
+/**
+ * The style tables lexers built, keyed by the properties the application set,
+ * which include the lexer's name and theme, and by the modification time and
+ * size of the theme file the lexer's Lua state loaded, so a theme edited on
+ * disk is parsed again. Lexers applying the same theme to the same language
+ * again, as when a document is activated, reuse the table rather than expand
+ * and parse each style property again. Only the thread Scintilla calls lexers
+ * on uses it.
+ */
+static std::unordered_map<std::string, std::shared_ptr<const l_StyleTable>>
+	l_style_tables;
+
+/**
+ * The most style tables kept. Once there are this many, they are all dropped
+ * before the next one is added; lexers keep the tables they use.
+ */
+#define STYLE_TABLES_MAX 64
+
+/**
+ * The trace LPeg lexers record events in. Only lexers on the thread Scintilla
+ * calls record events, so it has a single writer; the lexers of background
+ * jobs do not trace, and their jobs are recorded once they finish.
+ */
+static LPegTrace l_trace;
+
+/** The deepest "$(key)" references in property values are expanded. */
+#define EXPAND_MAXDEPTH 100
+
+/**
+ * Lexer properties that also expand "$(key)" and "%(key)" references in
+ * their values, the way `lexer.property_expanded` did in Lua. Expansions are
+ * remembered until a property is set, so expanding the same style properties
+ * again, as `SetStyles()` does each time a lexer is reapplied, copies strings
+ * rather than matching patterns.
+ * `Set()` hides `PropSetSimple::Set()`, so properties must be set through this
+ * class for expansions to be forgotten.
+ */
+class l_PropSet : public PropSetSimple {
+	/** The expanded values of properties, by key. */
+	std::unordered_map<std::string, std::string> expanded;
+	/** The keys of all properties ever set. */
+	std::set<std::string> keys;
+
+public:
+	/** Sets property *key* to *val* and forgets all expansions. */
+	void Set(const char *key, const char *val, int lenKey=-1, int lenVal=-1) {
+		PropSetSimple::Set(key, val, lenKey, lenVal);
+		keys.insert(lenKey < 0 ? std::string(key) : std::string(key, lenKey));
+		expanded.clear();
+	}
+
+	/** Returns the keys of all properties ever set. */
+	const std::set<std::string> &Keys() const { return keys; }
+
+	/**
+	 * Returns the value of property *key* with references replaced by the
+	 * expanded values of the properties they name.
+	 * A reference is "$" or "%" followed by balanced parentheses around a key.
+	 * References nested more than `EXPAND_MAXDEPTH` deep, as in cycles, expand
+	 * to nothing.
+	 */
+	const std::string &Expanded(const std::string &key, int depth=0) {
+		auto it = expanded.find(key);
+		if (it != expanded.end()) return it->second;
+		std::string value;
+		for (const char *p = Get(key.c_str()); *p; p++) {
+			if ((*p == '$' || *p == '%') && p[1] == '(') {
+				const char *q = p + 1;
+				for (int level = 0; *q; q++)
+					if (*q == '(')
+						level++;
+					else if (*q == ')' && --level == 0)
+						break;
+				if (*q) {
+					if (depth < EXPAND_MAXDEPTH)
+						value += Expanded(std::string(p + 2, q), depth + 1);
+					p = q;
+					continue;
+				}
+			}
+			value += *p;
+		}
+		return (expanded[key] = value);
+	}
+};
+
+class LexerLPeg;
+
+/** A background thread initializing lexers ahead of time for `LPEG_PREWARM`. */
+struct l_Warmup {
+	/** The languages to initialize lexers for, in order. */
+	std::vector<std::string> languages;
+	/** The properties of the lexer that started the warm-up, in order set. */
+	std::vector<std::pair<std::string, std::string>> props;
+	/** Whether or not the warm-up should stop before the next language. */
+	std::atomic<bool> cancel;
+	std::thread thread;
+
+	l_Warmup() : cancel(false) {}
+};
+
+/** A lexer initialized ahead of time, waiting for a lexer to adopt it. */
+struct l_WarmLexer {
+	/** What the lexer loaded, as returned by `LexerLPeg::LoadKey()`. */
+	std::string key;
+	/** The initialized lexer. */
+	LexerLPeg *lexer;
+	/** The lexer whose warm-up initialized it, which releases it if unused. */
+	const LexerLPeg *owner;
+	/**
+	 * The properties the lexer module, theme, and language lexer set while
+	 * loading. They are set once per Lua state, so adopters copy them.
+	 */
+	std::vector<std::pair<std::string, std::string>> props;
+};
+
+/**
+ * Lexers initialized by warm-ups and not adopted yet.
+ * Warm-up threads add lexers and the thread Scintilla calls lexers on takes
+ * them, both while holding `l_warm_lock`.
+ */
+static std::vector<l_WarmLexer> l_warm_lexers;
+static std::mutex l_warm_lock;
+
+/** Prints the error message of an unprotected Lua error. */
+static int l_panic(lua_State *L) {
+	fprintf(stderr, "Lua Error: %s.\n", lua_tostring(L, -1));
+	return 0;
+}
+
 #if CURSES
 #define A_COLORCHAR (A_COLOR | A_CHARTEXT)
 #endif
@@ -100,7 +741,7 @@ class LexerLPeg : public ILexer {
 	 * For use with SciTE, all of the style property strings generated for the
 	 * current lexer are placed in here.
 	 */
-	PropSetSimple props;
+	l_PropSet props;
 	/** The function to send Scintilla messages with. */
 	SciFnDirect SS;
 	/** The Scintilla object the lexer belongs to. */
@@ -120,6 +761,74 @@ class LexerLPeg : public ILexer {
 	 * determine which lexer grammar to use.
 	 */
 	bool ws[STYLE_MAX + 1];
+	/**
+	 * The amount of memory in KB used by the lexer's Lua state after the last
+	 * completed garbage collection cycle.
+	 */
+	int gc_base;
+	/** The lexer's statistics. */
+	LPegStatistics stats;
+	/** The scratch region an owned Lua state allocates from while lexing. */
+	l_Region region;
+	/**
+	 * Recently lexed lines of a line lexer, most recently used first.
+	 * Line lexers cannot look beyond the line they lex, so identical lines
+	 * always lex to the same style runs. The cache is cleared whenever the
+	 * lexer is (re-)initialized.
+	 */
+	std::list<l_CachedLine> line_cache;
+	/** The `line_cache` entries by hash. */
+	std::unordered_map<unsigned long long,
+	                   std::list<l_CachedLine>::iterator> line_index;
+	/**
+	 * The maximum number of lines in `line_cache`, from the
+	 * "lexer.lpeg.line.cache" property. `0` disables the cache.
+	 */
+	size_t line_cache_size;
+	/**
+	 * The number of Lua instructions between profiler samples during the
+	 * current lex or fold call, or `0` if the profiler is off.
+	 * The "lexer.lpeg.profile" property turns the profiler on for owned Lua
+	 * states.
+	 */
+	int profile_period;
+	/** The number of times each collapsed Lua call stack was sampled. */
+	std::unordered_map<std::string, size_t> profile;
+	/** What the last initialization cost. */
+	LPegLoadReport load_report;
+	/**
+	 * The properties the application set, in the order set, for the lexers of
+	 * background threads.
+	 */
+	std::vector<std::pair<std::string, std::string>> prop_values;
+	/**
+	 * The background job lexing the rest of a large range, if any.
+	 * The "lexer.lpeg.background" property sets the size of the ranges handed
+	 * off to background threads, and "lexer.lpeg.background.threads" the most
+	 * threads a job uses (by default, one per processor).
+	 */
+	std::shared_ptr<l_Job> job;
+	/**
+	 * The document position the current chain of background jobs lexes up to.
+	 */
+	Sci_PositionU job_end;
+	/** Cancelled jobs whose threads may still be running. */
+	std::vector<std::shared_ptr<l_Job>> retired_jobs;
+	/**
+	 * The range the last lex call styled itself and that still needs folding.
+	 * Background jobs fold the ranges they lex.
+	 */
+	Sci_PositionU fold_start, fold_end;
+	/**
+	 * The warm-up started by `LPEG_PREWARM`, if any. Lexers it initialized are
+	 * released with this lexer unless another lexer adopted them.
+	 */
+	std::shared_ptr<l_Warmup> warmup;
+	/**
+	 * The style properties `SetStyles()` set from the lexer's `_EXTRASTYLES`,
+	 * which a reloaded lexer may define differently.
+	 */
+	std::set<std::string> extra_styles;
 
 	/**
 	 * Logs the given error message or a Lua error message, prints it, and clears
@@ -130,13 +839,111 @@ class LexerLPeg : public ILexer {
 	 */
 	static void l_error(lua_State *L, const char *str=NULL) {
 		lua_getfield(L, LUA_REGISTRYINDEX, "sci_props");
-		PropSetSimple *props = static_cast<PropSetSimple *>(lua_touserdata(L, -1));
+		l_PropSet *props = static_cast<l_PropSet *>(lua_touserdata(L, -1));
 		lua_pop(L, 1); // props
 		props->Set("lexer.lpeg.error", str ? str : lua_tostring(L, -1));
 		fprintf(stderr, "Lua Error: %s.\n", str ? str : lua_tostring(L, -1));
 		lua_settop(L, 0);
 	}
 
+	/**
+	 * The profiler's count hook.
+	 * Records the current Lua call stack, outermost function first, with frames
+	 * named "function@file:line" and separated by ';'.
+	 */
+	static void l_profile(lua_State *L, lua_Debug *) {
+		lua_getfield(L, LUA_REGISTRYINDEX, "sci_profiler");
+		LexerLPeg *lexer = static_cast<LexerLPeg *>(lua_touserdata(L, -1));
+		lua_pop(L, 1); // sci_profiler
+		if (!lexer) return;
+		std::string stack;
+		lua_Debug frame;
+		char name[LUA_IDSIZE + 64];
+		for (int level = 0; lua_getstack(L, level, &frame); level++) {
+			lua_getinfo(L, "Sn", &frame);
+			const char *func = frame.name ? frame.name : "function";
+			const char *file = frame.short_src, *p = NULL;
+			if ((p = strrchr(file, '/')) || (p = strrchr(file, '\\'))) file = p + 1;
+			if (*frame.what == 'C')
+				snprintf(name, sizeof(name), "%s@[C]", func);
+			else
+				snprintf(name, sizeof(name), "%s@%s:%d", func, file, frame.linedefined);
+			stack.insert(0, level > 0 ? std::string(name) + ";" : name);
+		}
+		lexer->profile[stack]++, lexer->stats.profile_samples++;
+	}
+
+	/** Returns the profiler's samples in collapsed stack format. */
+	std::string ProfileText() {
+		std::string text;
+		for (const auto &sample : profile)
+			text += sample.first + " " + std::to_string(sample.second) + "\n";
+		return text;
+	}
+
+	/**
+	 * Returns the lexer's statistics as "name=value" lines, with times in
+	 * milliseconds and sizes in bytes.
+	 */
+	std::string StatisticsText() {
+		char text[1024];
+		const LPegStatistics &s = UpdateStatistics();
+		snprintf(text, sizeof(text),
+		         "lex_calls=%zu\nfold_calls=%zu\nbytes_requested=%zu\n"
+		         "bytes_lexed=%zu\ntokens=%zu\nlua_time=%.3f\nstyle_time=%.3f\n"
+		         "grammar_builds=%zu\ninits=%zu\nlua_memory=%lld\n"
+		         "lexers_cached=%zu\nlexer_cache_memory=%lld\n"
+		         "lexer_cache_budget=%lld\nlexer_evictions=%zu\n"
+		         "gc_time=%.3f\ngc_cycles=%d\nregion_size=%zu\n"
+		         "line_cache_hits=%zu\nline_cache_misses=%zu\n"
+		         "profile_samples=%zu\n",
+		         s.lex_calls, s.fold_calls, s.bytes_requested, s.bytes_lexed,
+		         s.tokens, s.lua_time, s.style_time, s.grammar_builds, s.inits,
+		         s.lua_memory, s.lexers_cached, s.lexer_cache_memory,
+		         s.lexer_cache_budget, s.lexer_evictions, s.gc_time, s.gc_cycles,
+		         s.region_size, s.line_cache_hits, s.line_cache_misses,
+		         s.profile_samples);
+		return text;
+	}
+
+	/** Fills in the statistics that are only measured when asked for. */
+	const LPegStatistics &UpdateStatistics() {
+		stats.region_size = region.size;
+		stats.lua_memory = L ? l_memory(L) : 0;
+		stats.lexer_cache_budget = props.GetInt("lexer.lpeg.lexer.cache") * 1024LL;
+		if (!L) return stats;
+		// The lexer module keeps count of its cache of loaded lexers.
+		lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED"), lua_getfield(L, -1, "lexer");
+		if (lua_istable(L, -1)) {
+			lua_getfield(L, -1, "_LEXERS");
+			stats.lexers_cached = static_cast<size_t>(lua_tointeger(L, -1));
+			lua_getfield(L, -2, "_LEXERMEMORY");
+			stats.lexer_cache_memory = static_cast<long long>(lua_tonumber(L, -1) *
+			                                                  1024);
+			lua_getfield(L, -3, "_EVICTIONS");
+			stats.lexer_evictions = static_cast<size_t>(lua_tointeger(L, -1));
+			lua_pop(L, 3); // _LEXERS, _LEXERMEMORY, and _EVICTIONS
+		}
+		lua_pop(L, 2); // lexer module or nil and _LOADED
+		return stats;
+	}
+
+	/**
+	 * Appends the profiler's samples to the file named by the
+	 * "lexer.lpeg.profile.file" property, if any, and forgets them.
+	 */
+	void WriteProfile() {
+		char path[FILENAME_MAX];
+		props.GetExpanded("lexer.lpeg.profile.file", path);
+		if (profile.empty() || !*path) return;
+		FILE *f = fopen(path, "ab");
+		if (!f) return;
+		std::string text = ProfileText();
+		fwrite(text.data(), 1, text.size(), f);
+		fclose(f);
+		profile.clear();
+	}
+
 	/** The lexer's `line_from_position` Lua function. */
 	static int l_line_from_position(lua_State *L) {
 		lua_getfield(L, LUA_REGISTRYINDEX, "sci_buffer");
@@ -156,7 +963,7 @@ class LexerLPeg : public ILexer {
 		lua_getfield(L, LUA_REGISTRYINDEX, "sci_buffer");
 		IDocument *buffer = static_cast<IDocument *>(lua_touserdata(L, -1));
 		lua_getfield(L, LUA_REGISTRYINDEX, "sci_props");
-		PropSetSimple *props = static_cast<PropSetSimple *>(lua_touserdata(L, -1));
+		l_PropSet *props = static_cast<l_PropSet *>(lua_touserdata(L, -1));
 		lua_pop(L, 2); // sci_props and sci_buffer
 
 		if (is_lexer)
@@ -184,6 +991,12 @@ class LexerLPeg : public ILexer {
 				lua_pushstring(L, props->Get(luaL_checkstring(L, 2)));
 			else
 				props->Set(luaL_checkstring(L, 2), luaL_checkstring(L, 3));
+		} else if (strcmp(key, "property_expanded") == 0) {
+			luaL_argcheck(L, !newindex, 3, "read-only property");
+			if (is_lexer)
+				l_pushlexerp(L, llexer_property);
+			else
+				lua_pushstring(L, props->Expanded(luaL_checkstring(L, 2)).c_str());
 		} else if (strcmp(key, "property_int") == 0) {
 			luaL_argcheck(L, !newindex, 3, "read-only property");
 			if (is_lexer)
@@ -227,10 +1040,8 @@ class LexerLPeg : public ILexer {
 	 * @param index The index the string property key.
 	 */
 	void lL_getexpanded(lua_State *L, int index) {
-		lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED"), lua_getfield(L, -1, "lexer");
-		lua_getfield(L, -1, "property_expanded");
-		lua_pushvalue(L, (index > 0) ? index : index - 3), lua_gettable(L, -2);
-		lua_replace(L, -4), lua_pop(L, 2); // property_expanded and lexer module
+		const char *key = lua_tostring(L, index);
+		lua_pushstring(L, key ? props.Expanded(key).c_str() : "");
 	}
 
 	/**
@@ -314,12 +1125,92 @@ class LexerLPeg : public ILexer {
 		free(style_copy);
 	}
 
+	/**
+	 * Returns the style table for the lexer's `_TOKENSTYLES`, which must be on
+	 * top of the stack, building it if no lexer built it yet.
+	 */
+	std::shared_ptr<const l_StyleTable> StyleTable() {
+		std::string key;
+		for (const auto &prop : prop_values)
+			key += prop.first + '\0' + prop.second + '\0';
+		lua_getfield(L, LUA_REGISTRYINDEX, "sci_theme_stamp");
+		if (lua_isstring(L, -1)) key += lua_tostring(L, -1);
+		lua_pop(L, 1); // theme stamp
+		auto it = l_style_tables.find(key);
+		if (it != l_style_tables.end()) return it->second;
+		if (l_style_tables.size() >= STYLE_TABLES_MAX) l_style_tables.clear();
+		auto table = std::make_shared<l_StyleTable>();
+		lua_pushstring(L, "style.default"), lL_getexpanded(L, -1);
+		l_parsestyle(lua_tostring(L, -1), &table->default_style);
+		lua_pop(L, 2); // style and "style.default"
+		lua_pushnil(L);
+		while (lua_next(L, -2)) {
+			if (lua_isstring(L, -2) && lua_isnumber(L, -1) &&
+			    lua_tointeger(L, -1) != STYLE_DEFAULT) {
+				lua_pushstring(L, "style."), lua_pushvalue(L, -3), lua_concat(L, 2);
+				lL_getexpanded(L, -1), lua_replace(L, -2);
+				l_parsestyle(lua_tostring(L, -1), &table->styles[lua_tostring(L, -3)]);
+				lua_pop(L, 1); // style
+			}
+			lua_pop(L, 1); // value
+		}
+		return (l_style_tables[key] = table);
+	}
+
+	/** Returns the attributes the view currently gives style number *num*. */
+	l_Style ViewStyle(int num) {
+		l_Style style;
+		for (int attr = 0; attr < SA_COUNT; attr++)
+			if (attr != SA_FONT)
+				style.Set(attr, static_cast<int>(SS(sci, l_style_get[attr], num, 0)));
+		char font[256] = "";
+		if (SS(sci, SCI_STYLEGETFONT, num, 0) < static_cast<sptr_t>(sizeof(font)))
+			SS(sci, SCI_STYLEGETFONT, num, reinterpret_cast<sptr_t>(font));
+		style.Set(SA_FONT, 0), style.font = font;
+		return style;
+	}
+
+	/**
+	 * Styles the view with style table *table* for the lexer's
+	 * `_TOKENSTYLES`, which must be on top of the stack.
+	 * The result is the same as setting the default style, copying it to all
+	 * styles with `SCI_STYLECLEARALL`, and setting each token's style, but
+	 * only the attributes that differ from the view's current ones are sent,
+	 * since each change makes Scintilla measure and redraw again.
+	 */
+	void ApplyStyles(const l_StyleTable &table) {
+		const l_Style *styles[STYLE_MAX + 1] = {};
+		lua_pushnil(L);
+		while (lua_next(L, -2)) {
+			if (lua_isstring(L, -2) && lua_isnumber(L, -1)) {
+				lua_Integer num = lua_tointeger(L, -1);
+				auto it = table.styles.find(lua_tostring(L, -2));
+				if (num >= 0 && num <= STYLE_MAX && it != table.styles.end())
+					styles[num] = &it->second;
+			}
+			lua_pop(L, 1); // value
+		}
+		l_Style base = ViewStyle(STYLE_DEFAULT);
+		base.Overlay(table.default_style);
+		for (int num = 0; num <= STYLE_MAX; num++) {
+			l_Style style = base, view = ViewStyle(num);
+			if (styles[num] && num != STYLE_DEFAULT) style.Overlay(*styles[num]);
+			if (style.font != view.font)
+				SS(sci, SCI_STYLESETFONT, num,
+				   reinterpret_cast<sptr_t>(style.font.c_str()));
+			for (int attr = 0; attr < SA_COUNT; attr++)
+				if (attr != SA_FONT && style.values[attr] != view.values[attr])
+					SS(sci, l_style_set[attr], num, style.values[attr]);
+		}
+	}
+
 	/**
 	 * Iterates through the lexer's `_TOKENSTYLES`, setting the style properties
 	 * for all defined styles, or for SciTE, generates the set of style properties
 	 * instead of directly setting style properties.
 	 */
 	bool SetStyles() {
+		LPegTraceScope scope(Tracer(), "SetStyles", "lexer");
 		// If the lexer defines additional styles, set their properties first (if
 		// the user has not already defined them).
 		l_getlexerfield(L, "_EXTRASTYLES");
@@ -327,8 +1218,10 @@ class LexerLPeg : public ILexer {
 		while (lua_next(L, -2)) {
 			if (lua_isstring(L, -2) && lua_isstring(L, -1)) {
 				lua_pushstring(L, "style."), lua_pushvalue(L, -3), lua_concat(L, 2);
-				if (!*props.Get(lua_tostring(L, -1)))
+				if (!*props.Get(lua_tostring(L, -1))) {
 					props.Set(lua_tostring(L, -1), lua_tostring(L, -2));
+					extra_styles.insert(lua_tostring(L, -1));
+				}
 				lua_pop(L, 1); // style name
 			}
 			lua_pop(L, 1); // value
@@ -344,6 +1237,15 @@ class LexerLPeg : public ILexer {
 			// function and error.
 			return true;
 		}
+#if !CURSES
+		// Scinterm keeps bold and underline in the weight attribute, so curses
+		// builds set every style attribute as before.
+		if (own_lua) {
+			ApplyStyles(*StyleTable());
+			lua_pop(L, 1); // _TOKENSTYLES
+			return true;
+		}
+#endif
 		lua_pushstring(L, "style.default"), lL_getexpanded(L, -1);
 		SetStyle(STYLE_DEFAULT, lua_tostring(L, -1));
 		lua_pop(L, 2); // style and "style.default"
@@ -404,10 +1306,18 @@ class LexerLPeg : public ILexer {
 	 */
 	bool Init() {
 		char home[FILENAME_MAX], lexer[50], theme[FILENAME_MAX];
+		ClearLineCache();
+		line_cache_size = props.GetInt("lexer.lpeg.line.cache", 4096);
 		props.GetExpanded("lexer.lpeg.home", home);
 		props.GetExpanded("lexer.name", lexer);
 		props.GetExpanded("lexer.lpeg.color.theme", theme);
 		if (!*home || !*lexer || !L) return false;
+		LPegTraceScope scope(Tracer(), "Init", "lexer");
+		stats.inits++;
+		if (own_lua) AdoptWarmLexer();
+		double mark = l_clock();
+		long long memory = l_memory(L);
+		load_report = LPegLoadReport();
 
 		lua_pushlightuserdata(L, reinterpret_cast<void *>(&props));
 		lua_setfield(L, LUA_REGISTRYINDEX, "sci_props");
@@ -432,6 +1342,7 @@ class LexerLPeg : public ILexer {
 			l_setconstant(L, SC_FOLDLEVELWHITEFLAG, "FOLD_BLANK");
 			l_setconstant(L, SC_FOLDLEVELHEADERFLAG, "FOLD_HEADER");
 			l_setmetatable(L, "sci_lexer", llexer_property);
+			load_report.module_time = l_lap(mark);
 			if (*theme) {
 				// Load the theme.
 				if (!(strstr(theme, "/") || strstr(theme, "\\"))) { // theme name
@@ -443,8 +1354,17 @@ class LexerLPeg : public ILexer {
 				} else lua_pushstring(L, theme); // path to theme
 				if (luaL_loadfile(L, lua_tostring(L, -1)) != LUA_OK ||
 				    lua_pcall(L, 0, 0, 0) != LUA_OK) return (l_error(L), false);
+				// Record the version of the theme its styles come from.
+				struct stat st;
+				if (stat(lua_tostring(L, -1), &st) == 0)
+					lua_pushfstring(L, "%s|%I|%I", lua_tostring(L, -1),
+					                static_cast<lua_Integer>(st.st_mtime),
+					                static_cast<lua_Integer>(st.st_size));
+				else lua_pushnil(L);
+				lua_setfield(L, LUA_REGISTRYINDEX, "sci_theme_stamp");
 				lua_pop(L, 1); // theme
 			}
+			load_report.theme_time = l_lap(mark);
 
 			// Restore `package.path`.
 			lua_getglobal(L, "package");
@@ -459,6 +1379,7 @@ class LexerLPeg : public ILexer {
 			lua_pushstring(L, lexer), lua_pushnil(L), lua_pushboolean(L, 1);
 			if (lua_pcall(L, 3, 1, 0) != LUA_OK) return (l_error(L), false);
 		} else return (l_error(L, "'lexer.load' function not found"), false);
+		load_report.load_time = l_lap(mark);
 		lua_getfield(L, LUA_REGISTRYINDEX, "sci_lexers");
 		lua_pushlightuserdata(L, reinterpret_cast<void *>(this));
 		lua_pushvalue(L, -3), lua_settable(L, -3), lua_pop(L, 1); // sci_lexers
@@ -479,13 +1400,403 @@ class LexerLPeg : public ILexer {
 				ws[i] = strstr(style_name, "whitespace") ? true : false;
 			}
 		}
-		lua_pop(L, 2); // _CHILDREN and lexer object
+		lua_pop(L, 1); // _CHILDREN
+		load_report.styles_time = l_lap(mark);
+
+		// Compile the grammar now rather than on the first lex, and measure it.
+		int top = lua_gettop(L);
+		lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+		lua_getfield(L, -1, "lpeg"), lua_getfield(L, -1, "footprint");
+		lua_getfield(L, -4, "_GRAMMAR");
+		if (!lua_isnil(L, -1)) stats.grammar_builds++;
+		if (lua_isfunction(L, -2) && !lua_isnil(L, -1) &&
+		    lua_pcall(L, 1, 3, 0) == LUA_OK) {
+			load_report.tree_size = lua_tointeger(L, -3);
+			load_report.code_size = lua_tointeger(L, -2);
+			load_report.ktable_size = lua_tointeger(L, -1);
+		}
+		lua_settop(L, top - 1); // footprint results and lexer object
+		if (LPegTrace *trace = Tracer())
+			trace->Add("compile grammar", "lexer", mark, l_clock());
+		load_report.compile_time = l_lap(mark);
+		load_report.memory_delta = l_memory(L) - memory;
 
 		reinit = false;
 		props.Set("lexer.lpeg.error", "");
 		return true;
 	}
 
+	/**
+	 * Returns what initializing the lexer loads: its home, language, and theme.
+	 * Other properties are only read when lexing and folding.
+	 */
+	std::string LoadKey() {
+		std::string key = props.Expanded("lexer.lpeg.home");
+		key += '\0', key += props.Expanded("lexer.name");
+		key += '\0', key += props.Expanded("lexer.lpeg.color.theme");
+		return key;
+	}
+
+	/**
+	 * Initializes a lexer for each language of warm-up *warmup* in turn, until
+	 * done or cancelled, and adds it to `l_warm_lexers` for lexers of *owner*'s
+	 * properties to adopt.
+	 * It runs on the warm-up's thread.
+	 */
+	static void WarmUp(l_Warmup *warmup, const LexerLPeg *owner) {
+		for (const auto &language : warmup->languages) {
+			if (warmup->cancel) break;
+			LexerLPeg *lexer = new LexerLPeg();
+			for (const auto &prop : warmup->props)
+				lexer->props.Set(prop.first.c_str(), prop.second.c_str());
+			lexer->props.Set("lexer.name", language.c_str());
+			lexer->props.Set("lexer.lpeg.trace", "0");
+			l_WarmLexer warm;
+			warm.key = lexer->LoadKey(), warm.lexer = lexer, warm.owner = owner;
+			{
+				std::lock_guard<std::mutex> lock(l_warm_lock);
+				bool warmed = std::any_of(l_warm_lexers.begin(), l_warm_lexers.end(),
+				                          [&warm](const l_WarmLexer &other) {
+					return other.key == warm.key;
+				});
+				if (warmed) {
+					lexer->Release();
+					continue;
+				}
+			}
+			std::set<std::string> keys = lexer->props.Keys();
+			if (!lexer->L || !lexer->Init()) {
+				lexer->Release();
+				continue;
+			}
+			for (const auto &key : lexer->props.Keys())
+				if (!keys.count(key) && key != "lexer.lpeg.error")
+					warm.props.push_back(std::make_pair(key,
+					                                    lexer->props.Get(key.c_str())));
+			std::lock_guard<std::mutex> lock(l_warm_lock);
+			l_warm_lexers.push_back(warm);
+		}
+	}
+
+	/**
+	 * Takes over the Lua state of a lexer a warm-up initialized for the same
+	 * language, home, and theme, if there is one and the lexer's own Lua state
+	 * has not loaded anything yet. The grammar is then already compiled, and
+	 * `Init()` only attaches it.
+	 */
+	void AdoptWarmLexer() {
+		lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED"), lua_getfield(L, -1, "lexer");
+		bool loaded = !lua_isnil(L, -1);
+		lua_pop(L, 2); // lexer module or nil and _LOADED
+		if (loaded) return;
+		l_WarmLexer warm;
+		{
+			std::lock_guard<std::mutex> lock(l_warm_lock);
+			std::string key = LoadKey();
+			auto it = std::find_if(l_warm_lexers.begin(), l_warm_lexers.end(),
+			                       [&key](const l_WarmLexer &other) {
+				return other.key == key;
+			});
+			if (it == l_warm_lexers.end()) return;
+			warm = *it, l_warm_lexers.erase(it);
+		}
+		LPegTraceScope scope(Tracer(), "adopt warm lexer", "lexer");
+		LexerLPeg *lexer = warm.lexer;
+		std::swap(L, lexer->L), std::swap(region, lexer->region);
+		std::swap(gc_base, lexer->gc_base);
+		lua_setallocf(L, l_alloc, &region);
+		lua_setallocf(lexer->L, l_alloc, &lexer->region);
+		lua_getfield(L, LUA_REGISTRYINDEX, "sci_lexers");
+		lua_pushlightuserdata(L, reinterpret_cast<void *>(lexer));
+		lua_pushnil(L), lua_settable(L, -3), lua_pop(L, 1); // sci_lexers
+		for (const auto &prop : warm.props)
+			props.Set(prop.first.c_str(), prop.second.c_str());
+		extra_styles.insert(lexer->extra_styles.begin(), lexer->extra_styles.end());
+		lexer->Release();
+	}
+
+	/**
+	 * Stops the warm-up this lexer started, if any, and releases the lexers it
+	 * initialized that no lexer adopted.
+	 */
+	void StopWarmUp() {
+		if (!warmup) return;
+		warmup->cancel = true;
+		warmup->thread.join();
+		warmup.reset();
+		std::vector<LexerLPeg *> unused;
+		{
+			std::lock_guard<std::mutex> lock(l_warm_lock);
+			for (auto it = l_warm_lexers.begin(); it != l_warm_lexers.end();)
+				if (it->owner == this)
+					unused.push_back(it->lexer), it = l_warm_lexers.erase(it);
+				else
+					++it;
+		}
+		for (auto lexer : unused) lexer->Release();
+	}
+
+	/**
+	 * Makes the lexer module load lexer *name*, and the lexers that loaded it,
+	 * again the next time they are needed.
+	 * @return whether or not the lexer's language was one of them
+	 */
+	bool Unload(const char *name) {
+		bool unloaded = false;
+		lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED"), lua_getfield(L, -1, "lexer");
+		if (lua_istable(L, -1)) {
+			lua_getfield(L, -1, "unload");
+			lua_pushstring(L, name);
+			if (lua_pcall(L, 1, 1, 0) != LUA_OK) return (l_error(L), false);
+			const std::string &language = props.Expanded("lexer.name");
+			for (int i = 1; i <= static_cast<int>(lua_rawlen(L, -1)); i++) {
+				lua_rawgeti(L, -1, i);
+				if (lua_tostring(L, -1) && language == lua_tostring(L, -1))
+					unloaded = true;
+				lua_pop(L, 1); // name
+			}
+			lua_pop(L, 1); // unloaded names
+		}
+		lua_pop(L, 2); // lexer module or nil and _LOADED
+		return unloaded;
+	}
+
+	/**
+	 * Loads lexer *name*, whose file changed, and the lexers that loaded it
+	 * again, recompiling the lexer's grammar if its language was one of them.
+	 * The lexer module and theme stay loaded. Lexers warm-ups of this lexer
+	 * initialized for affected languages are released.
+	 * @return whether or not the lexer was re-initialized and its document
+	 *   needs lexing again
+	 */
+	bool Reload(const char *name) {
+		LPegTraceScope scope(Tracer(), "Reload", "lexer");
+		std::vector<LexerLPeg *> stale;
+		{
+			std::lock_guard<std::mutex> lock(l_warm_lock);
+			for (auto it = l_warm_lexers.begin(); it != l_warm_lexers.end();)
+				if (it->owner == this && it->lexer->Unload(name))
+					stale.push_back(it->lexer), it = l_warm_lexers.erase(it);
+				else
+					++it;
+		}
+		for (auto lexer : stale) lexer->Release();
+		if (!L || !Unload(name)) return false;
+		// The reloaded lexer may style tokens differently.
+		for (const auto &key : extra_styles) props.Set(key.c_str(), "");
+		extra_styles.clear();
+		l_style_tables.clear();
+		CancelJob();
+		reinit = true;
+		return Init();
+	}
+
+	/**
+	 * Prepares an owned Lua state for a lex or fold call: the garbage collector
+	 * is stopped so no collection steps run in the middle of the call, new
+	 * objects come from the scratch region, and the profiler samples the call
+	 * if it is on.
+	 * `EndCall()` restarts the collector; garbage the call left is collected by
+	 * `StepGC()` when the application is idle, or by the collector's own steps
+	 * as later calls allocate.
+	 * @return the stack top to pass to `EndCall()`
+	 */
+	int BeginCall() {
+		if (own_lua) lua_gc(L, LUA_GCSTOP, 0), region.active = true;
+		profile_period = own_lua ? props.GetInt("lexer.lpeg.profile") : 0;
+		if (profile_period > 0) {
+			lua_pushlightuserdata(L, reinterpret_cast<void *>(this));
+			lua_setfield(L, LUA_REGISTRYINDEX, "sci_profiler");
+			lua_sethook(L, l_profile, LUA_MASKCOUNT, profile_period);
+		}
+		return lua_gettop(L);
+	}
+
+	/**
+	 * Releases the temporaries of a lex or fold call, restarts the garbage
+	 * collector `BeginCall()` stopped and, if memory has doubled since the last
+	 * collection cycle without the application becoming idle, finishes the
+	 * current cycle.
+	 * @param top The stack top returned by `BeginCall()`.
+	 */
+	void EndCall(int top) {
+		if (lua_gettop(L) > top) lua_settop(L, top);
+		if (profile_period > 0) lua_sethook(L, NULL, 0, 0), profile_period = 0;
+		region.active = false;
+		if (own_lua) lua_gc(L, LUA_GCRESTART, 0);
+		CollectIfGrown();
+	}
+
+	/**
+	 * Finishes the current garbage collection cycle if memory has doubled since
+	 * the last cycle completed.
+	 */
+	void CollectIfGrown() {
+		if (own_lua && lua_gc(L, LUA_GCCOUNT, 0) > 2 * gc_base) {
+			LPegTraceScope scope(Tracer(), "collect garbage", "lexer");
+			while (!StepGC(0)) {}
+		}
+	}
+
+	/**
+	 * Returns the trace to record events in, or `NULL` if the
+	 * "lexer.lpeg.trace" property is `0`. The trace keeps as many events as
+	 * the property asks for.
+	 */
+	LPegTrace *Tracer() {
+		int size = props.GetInt("lexer.lpeg.trace");
+		if (size <= 0) return NULL;
+		if (l_trace.Size() != static_cast<size_t>(size)) l_trace.Resize(size);
+		return &l_trace;
+	}
+
+	/** Records the time the thread of finished background job *job* took. */
+	void TraceJob(const l_Job &job) {
+		if (LPegTrace *trace = Tracer())
+			trace->Add("background job", "lexer", job.started, job.finished,
+			           job.thread_id);
+	}
+
+	/**
+	 * Runs incremental garbage collection steps until a cycle completes or
+	 * *budget* milliseconds elapse.
+	 * @param budget The number of milliseconds steps may run for, or `0` to
+	 *   only run a single step.
+	 * @return `true` if a collection cycle completed
+	 */
+	bool StepGC(int budget) {
+		if (!own_lua) return false;
+		double start = l_clock(), now = start;
+		bool done = false;
+		do {
+			done = lua_gc(L, LUA_GCSTEP, 0) != 0;
+			now = l_clock();
+		} while (!done && now - start < budget);
+		stats.gc_time += now - start;
+		if (done) gc_base = lua_gc(L, LUA_GCCOUNT, 0), stats.gc_cycles++;
+		return done;
+	}
+
+	/**
+	 * Returns the cached line with hash *hash* and text *text* of length *len*
+	 * and marks it most recently used, or returns `NULL`.
+	 */
+	const l_CachedLine *FindLine(unsigned long long hash, const char *text,
+	                             size_t len) {
+		auto it = line_index.find(hash);
+		if (it == line_index.end()) return NULL;
+		const l_CachedLine &line = *it->second;
+		if (line.text.size() != len || memcmp(line.text.data(), text, len) != 0)
+			return NULL; // hash collision
+		line_cache.splice(line_cache.begin(), line_cache, it->second);
+		return &line;
+	}
+
+	/**
+	 * Caches style runs *runs* for the line with hash *hash* and text *text* of
+	 * length *len*, evicting the least recently used line if the cache is full.
+	 */
+	void CacheLine(unsigned long long hash, const char *text, size_t len,
+	               const std::vector<std::pair<Sci_PositionU, int>> &runs) {
+		auto it = line_index.find(hash);
+		if (it != line_index.end())
+			line_cache.erase(it->second), line_index.erase(it);
+		else if (line_cache.size() >= line_cache_size) {
+			line_index.erase(line_cache.back().hash);
+			line_cache.pop_back();
+		}
+		line_cache.push_front(l_CachedLine());
+		l_CachedLine &line = line_cache.front();
+		line.hash = hash, line.text.assign(text, len), line.runs = runs;
+		line_index[hash] = line_cache.begin();
+	}
+
+	/** Empties the line cache. */
+	void ClearLineCache() {
+		line_cache.clear();
+		line_index.clear();
+	}
+
+	/**
+	 * Lexes the lines spanning positions *startPos* up to *endPos* one at a time
+	 * with a lexer that has a `_LEXBYLINE` flag.
+	 * The lexer module's `lex()` does the same, but has to split a copy of the
+	 * text into lines and join the lines' token tables in Lua. Here lines come
+	 * from the document's own line starts and each line's tokens are styled as
+	 * soon as the line is matched.
+	 * @param styler The accessor to style with.
+	 * @param buffer The document interface.
+	 * @param startPos The position to start lexing at. It must be the start of
+	 *   a line.
+	 * @param endPos The position to stop lexing at.
+	 */
+	void LexByLine(LexAccessor &styler, IDocument *buffer, Sci_PositionU startPos,
+	               Sci_PositionU endPos) {
+		lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED"), lua_getfield(L, -1, "lpeg");
+		lua_getfield(L, -1, "match"), lua_replace(L, -3), lua_pop(L, 1); // lpeg
+		l_getlexerfield(L, "_GRAMMAR");
+		l_getlexerfield(L, "_TOKENSTYLES");
+		const char *text = buffer->BufferPointer();
+		std::vector<std::pair<Sci_PositionU, int>> runs;
+		styler.StartAt(startPos);
+		styler.StartSegment(startPos);
+		Sci_Position line = buffer->LineFromPosition(startPos);
+		for (Sci_PositionU pos = startPos, next = 0; pos < endPos; pos = next) {
+			next = buffer->LineStart(++line);
+			if (next <= pos || next > endPos) next = endPos;
+			size_t len = next - pos;
+			unsigned long long hash = 0;
+			bool cache = line_cache_size > 0 && len <= LINECACHE_MAXLINE;
+			if (cache) {
+				hash = l_hash(text + pos, len);
+				const l_CachedLine *cached = FindLine(hash, text + pos, len);
+				if (cached) {
+					for (size_t i = 0; i < cached->runs.size(); i++)
+						styler.ColourTo(pos + cached->runs[i].first - 1,
+						                cached->runs[i].second);
+					stats.line_cache_hits++;
+					continue;
+				}
+				stats.line_cache_misses++;
+			}
+			runs.clear();
+			double mark = l_clock();
+			lua_pushvalue(L, -3), lua_pushvalue(L, -3); // lpeg.match, _GRAMMAR
+			lua_pushlstring(L, text + pos, len);
+			if (lua_pcall(L, 2, 1, 0) != LUA_OK) return l_error(L);
+			stats.lua_time += l_lap(mark), stats.bytes_lexed += len;
+			if (lua_istable(L, -1)) {
+				// Loop through token-position pairs.
+				size_t ntokens = lua_rawlen(L, -1);
+				stats.tokens += ntokens / 2;
+				for (size_t i = 1; i < ntokens; i += 2) {
+					int style = STYLE_DEFAULT;
+					lua_rawgeti(L, -1, i), lua_rawget(L, -3); // _TOKENSTYLES[token]
+					if (!lua_isnil(L, -1)) style = lua_tointeger(L, -1);
+					lua_pop(L, 1); // _TOKENSTYLES[token]
+					lua_rawgeti(L, -1, i + 1); // pos
+					Sci_PositionU position = pos + lua_tointeger(L, -1) - 1;
+					lua_pop(L, 1); // pos
+					if (style < 0 || style > STYLE_MAX)
+						return l_error(L, "Bad style number");
+					if (position > next) position = next;
+					styler.ColourTo(position - 1, style);
+					if (cache) runs.push_back(std::make_pair(position - pos, style));
+				}
+			}
+			lua_pop(L, 1); // line's token table
+			// Use the default style to the end of the line if none was specified.
+			styler.ColourTo(next - 1, STYLE_DEFAULT);
+			if (cache) {
+				runs.push_back(std::make_pair(len, static_cast<int>(STYLE_DEFAULT)));
+				CacheLine(hash, text + pos, len, runs);
+			}
+			stats.style_time += l_lap(mark);
+		}
+		lua_pop(L, 3); // _TOKENSTYLES, _GRAMMAR, and lpeg.match
+		styler.Flush();
+	}
+
 	/**
 	 * When *lparam* is `0`, returns the size of the buffer needed to store the
 	 * given string *str* in; otherwise copies *str* into the buffer *lparam* and
@@ -500,11 +1811,621 @@ class LexerLPeg : public ILexer {
 		return reinterpret_cast<void *>(strlen(str));
 	}
 
+	/**
+	 * Returns the position to start lexing at in order to restyle from
+	 * *startPos*.
+	 * This is the beginning of the style at *startPos* so LPeg matches it. For
+	 * multilang lexers, it is whitespace since embedded languages have
+	 * [lang]_whitespace styles. This is so LPeg can start matching child
+	 * languages instead of parent ones if necessary. Line lexers only need to
+	 * start at the beginning of the current line.
+	 * @param styler The accessor to read styles with.
+	 * @param buffer The document interface.
+	 * @param startPos The position to restyle from.
+	 * @param initStyle The style before *startPos*.
+	 * @param by_line Whether or not the lexer is a line lexer.
+	 * @param limit The position not to start before.
+	 */
+	Sci_PositionU LexStart(LexAccessor &styler, IDocument *buffer,
+	                       Sci_PositionU startPos, int initStyle, bool by_line,
+	                       Sci_PositionU limit = 0) {
+		if (startPos <= limit) return startPos;
+		Sci_PositionU i = startPos;
+		if (by_line)
+			i = buffer->LineStart(buffer->LineFromPosition(startPos));
+		else
+			while (i > limit && styler.StyleAt(i - 1) == initStyle) i--;
+		if (multilang)
+			while (i > limit && !ws[static_cast<size_t>(styler.StyleAt(i))]) i--;
+		return std::max(i, limit);
+	}
+
+	/**
+	 * Returns the lexer's token names and their style numbers.
+	 * Style numbers depend on the order Lua happens to iterate over tables in,
+	 * so they can differ between two Lua states that loaded the same lexer.
+	 */
+	std::vector<std::pair<std::string, int>> GetStyleNumbers() {
+		std::vector<std::pair<std::string, int>> styles;
+		l_getlexerfield(L, "_TOKENSTYLES");
+		lua_pushnil(L);
+		while (lua_next(L, -2)) {
+			if (lua_isstring(L, -2) && lua_isnumber(L, -1))
+				styles.push_back(std::make_pair(lua_tostring(L, -2),
+				                                static_cast<int>(lua_tointeger(L, -1))));
+			lua_pop(L, 1); // value
+		}
+		lua_pop(L, 1); // _TOKENSTYLES
+		return styles;
+	}
+
+	/**
+	 * Makes the lexer use the style numbers *styles* returned by another
+	 * lexer's `GetStyleNumbers()`.
+	 */
+	void SetStyleNumbers(const std::vector<std::pair<std::string, int>> &styles) {
+		l_getlexerfield(L, "_TOKENSTYLES");
+		for (const auto &style : styles)
+			lua_pushinteger(L, style.second), lua_setfield(L, -2, style.first.c_str());
+		lua_pop(L, 1); // _TOKENSTYLES
+		if (!multilang) return;
+		for (int i = 0; i <= STYLE_MAX; i++) ws[i] = false;
+		for (const auto &style : styles)
+			if (style.second >= 0 && style.second <= STYLE_MAX)
+				ws[style.second] = strstr(style.first.c_str(), "whitespace") != NULL;
+	}
+
+	/**
+	 * Returns a new lexer for a thread of background job *job*, with the
+	 * properties and style numbers of the lexer that started the job, or `NULL`
+	 * if it fails to initialize.
+	 */
+	static LexerLPeg *JobLexer(const l_Job &job) {
+		LexerLPeg *lexer = new LexerLPeg();
+		for (const auto &prop : job.props)
+			lexer->props.Set(prop.first.c_str(), prop.second.c_str());
+		lexer->props.Set("lexer.lpeg.background", "0");
+		lexer->props.Set("lexer.lpeg.slice", "0");
+		lexer->props.Set("lexer.lpeg.trace", "0");
+		if (!lexer->L || !lexer->Init()) return (lexer->Release(), nullptr);
+		lexer->SetStyleNumbers(job.styles);
+		return lexer;
+	}
+
+	/**
+	 * Lexes snapshot *doc* with *lexer* from *pos* up to *end* one chunk at a
+	 * time, until done or until background job *job* is cancelled.
+	 * @return the position lexed up to
+	 */
+	static size_t LexChunks(LexerLPeg *lexer, l_Snapshot &doc, size_t pos,
+	                        size_t end, int init_style, const l_Job &job) {
+		while (pos < end && !job.cancel) {
+			size_t next = std::min(static_cast<size_t>(doc.LineStart(
+				doc.LineFromPosition(pos + BACKGROUND_CHUNKSIZE) + 1)), end);
+			lexer->Lex(pos, next - pos, pos > 0 ? doc.StyleAt(pos - 1) :
+			           init_style, &doc);
+			pos = next;
+		}
+		return pos;
+	}
+
+	/** Lexes segment *seg* of background job *job* on the segment's thread. */
+	static void LexSegment(const l_Job *job, l_Segment *seg) {
+		LexerLPeg *lexer = JobLexer(*job);
+		if (!lexer) return;
+		l_Snapshot &doc = seg->doc;
+		doc.FindLines();
+		doc.styles.assign(doc.text.size(), 0);
+		if (!doc.styles.empty()) doc.styles[0] = seg->init_style;
+		seg->lexed = LexChunks(lexer, doc, 0, doc.text.size(), seg->init_style,
+		                       *job) == doc.text.size();
+		lexer->Release();
+	}
+
+	/**
+	 * Splits the snapshot of background job *job* into one part per thread and
+	 * starts lexing all but the first part on threads of their own.
+	 * Parts start after blank lines where possible, since tokens rarely span
+	 * them.
+	 */
+	static std::vector<std::unique_ptr<l_Segment>> SplitJob(l_Job &job) {
+		std::vector<std::unique_ptr<l_Segment>> segments;
+		const std::string &text = job.doc.text;
+		size_t n = std::min(static_cast<size_t>(std::max(job.threads, 1)),
+		                    text.size() / BACKGROUND_MINSEGMENT);
+		std::vector<size_t> starts;
+		for (size_t i = 1; i < n; i++) {
+			size_t pos = text.size() / n * i;
+			size_t limit = pos + BACKGROUND_MINSEGMENT / 4;
+			size_t blank = text.find("\n\n", pos);
+			if (blank == std::string::npos || blank > limit)
+				blank = text.find("\n\r\n", pos);
+			if (blank != std::string::npos && blank < limit)
+				pos = text.find('\n', blank + 1) + 1;
+			else
+				pos = job.doc.LineStart(job.doc.LineFromPosition(pos) + 1);
+			if (pos < text.size() && (starts.empty() || pos > starts.back()))
+				starts.push_back(pos);
+		}
+		for (size_t i = 0; i < starts.size(); i++) {
+			size_t end = i + 1 < starts.size() ? starts[i + 1] : text.size();
+			segments.emplace_back(new l_Segment());
+			l_Segment &seg = *segments.back();
+			seg.start = starts[i], seg.init_style = job.whitespace;
+			seg.doc.text.assign(text, starts[i], end - starts[i]);
+			seg.doc.code_page = job.doc.code_page;
+			seg.doc.tab_width = job.doc.tab_width;
+			seg.doc.first_indent = job.doc.GetLineIndentation(
+				job.doc.LineFromPosition(starts[i]));
+			seg.thread = std::thread(LexSegment, &job, &seg);
+		}
+		return segments;
+	}
+
+	/**
+	 * Copies the styles and line states of background job segment *seg* from
+	 * *pos* up to *end* into the job's snapshot *doc*.
+	 */
+	static void CopySegment(l_Snapshot &doc, const l_Segment &seg, size_t pos,
+	                        size_t end) {
+		doc.StartStyling(pos, '\377');
+		doc.SetStyles(end - pos, &seg.doc.styles[pos - seg.start]);
+		if (!seg.doc.line_states_set) return;
+		Sci_Position first = doc.LineFromPosition(seg.start);
+		for (Sci_Position line = doc.LineFromPosition(pos);
+		     line < doc.LineFromPosition(end); line++)
+			doc.SetLineState(line, seg.doc.GetLineState(line - first));
+	}
+
+	/**
+	 * Lexes and folds a background job's snapshot on the job's thread with a
+	 * lexer of its own, one chunk at a time, until the snapshot is done or the
+	 * job is cancelled.
+	 * Parts of large snapshots are lexed ahead on extra threads. Their styles
+	 * are used once the part before them ends where they guessed it would, and
+	 * lexed again otherwise.
+	 */
+	static void LexJob(std::shared_ptr<l_Job> job) {
+		job->started = l_clock(), job->thread_id = LPegTrace::CurrentThread();
+		l_Snapshot &doc = job->doc;
+		doc.FindLines();
+		doc.styles.assign(doc.text.size(), 0);
+		if (!doc.styles.empty()) doc.styles[0] = job->init_style;
+		LexerLPeg *lexer = JobLexer(*job);
+		if (lexer) {
+			auto segments = SplitJob(*job);
+			l_Segment *seg = nullptr; // the segment `pos` is in, if usable
+			size_t pos = 0, len = doc.text.size(), next = 0;
+			while (pos < len && !job->cancel) {
+				if (next < segments.size() && pos == segments[next]->start) {
+					seg = segments[next++].get();
+					seg->thread.join();
+					if (!seg->lexed || (!job->by_line &&
+					    doc.StyleAt(pos - 1) != seg->init_style))
+						seg = nullptr; // mispredicted
+				}
+				size_t end = doc.LineStart(
+					doc.LineFromPosition(pos + BACKGROUND_CHUNKSIZE) + 1);
+				if (next < segments.size() && end > segments[next]->start)
+					end = segments[next]->start;
+				if (seg)
+					CopySegment(doc, *seg, pos, end);
+				else
+					LexChunks(lexer, doc, pos, end, job->init_style, *job);
+				size_t from = std::max(pos, job->fold_from);
+				lexer->fold_start = from, lexer->fold_end = end; // even if copied
+				if (end > from)
+					lexer->Fold(from, end - from, doc.StyleAt(from - 1), &doc);
+				job->ready = pos = end;
+			}
+			for (; next < segments.size(); next++) segments[next]->thread.join();
+			lexer->Release();
+		}
+		job->finished = l_clock();
+		job->done = true;
+	}
+
+	/**
+	 * Starts a background job lexing from *startPos* up to *endPos*, or to as
+	 * much of it as one job copies.
+	 * @param styler The accessor to read styles with.
+	 * @param buffer The document interface.
+	 * @param startPos The position styles are needed from.
+	 * @param endPos The position styles are needed up to.
+	 * @param by_line Whether or not the lexer is a line lexer.
+	 */
+	void StartJob(LexAccessor &styler, IDocument *buffer, Sci_PositionU startPos,
+	              Sci_PositionU endPos, bool by_line) {
+		Sci_PositionU i = LexStart(styler, buffer, startPos,
+		                           startPos > 0 ? styler.StyleAt(startPos - 1) : 0,
+		                           by_line);
+		Sci_PositionU end = endPos;
+		if (end - i > BACKGROUND_MAXJOB)
+			end = buffer->LineStart(
+				buffer->LineFromPosition(i + BACKGROUND_MAXJOB) + 1);
+		job = std::make_shared<l_Job>();
+		job->start = i, job->merged = job->fold_from = startPos - i;
+		job->first_line = buffer->LineFromPosition(i);
+		job->init_style = styler.StyleAt(i);
+		job->by_line = by_line;
+		job->threads = props.GetInt("lexer.lpeg.background.threads",
+		                            std::thread::hardware_concurrency());
+		job->props = prop_values;
+		job->styles = GetStyleNumbers();
+		l_getlexerfield(L, "_NAME");
+		std::string whitespace = std::string(luaL_optstring(L, -1, "")) +
+		                         "_whitespace";
+		lua_pop(L, 1); // _NAME
+		for (const auto &style : job->styles)
+			if (style.first == whitespace) job->whitespace = style.second;
+		l_Snapshot &doc = job->doc;
+		doc.text.assign(buffer->BufferPointer() + i, end - i);
+		doc.code_page = buffer->CodePage();
+		doc.first_indent = buffer->GetLineIndentation(job->first_line);
+		if (SS && sci) doc.tab_width = SS(sci, SCI_GETTABWIDTH, 0, 0);
+		// Folding starts from the levels of the lines before `fold_from`.
+		for (Sci_Position line = job->first_line;
+		     line <= buffer->LineFromPosition(startPos); line++)
+			doc.levels.push_back(buffer->GetLevel(line));
+		job->thread = std::thread(LexJob, job);
+		job_end = endPos;
+	}
+
+	/**
+	 * Cancels the background job without waiting for its thread to finish its
+	 * current chunk.
+	 */
+	void CancelJob() {
+		if (!job) return;
+		job->cancel = true;
+		retired_jobs.push_back(job);
+		job.reset();
+	}
+
+	/** Waits for the threads of cancelled background jobs that finished. */
+	void ReapJobs() {
+		for (auto it = retired_jobs.begin(); it != retired_jobs.end();)
+			if ((*it)->done)
+				TraceJob(**it), (*it)->thread.join(), it = retired_jobs.erase(it);
+			else
+				++it;
+	}
+
+	/**
+	 * Returns whether or not the background job lexed its whole snapshot and all
+	 * of its styles were applied.
+	 */
+	bool JobFinished() {
+		return job->done && job->merged >= job->ready;
+	}
+
+	/**
+	 * Returns the document position of the end of the last line the view shows,
+	 * or 0 if the lexer cannot ask the view.
+	 * @param buffer The document interface.
+	 */
+	Sci_PositionU VisibleEnd(IDocument *buffer) {
+		if (!SS || !sci) return 0;
+		sptr_t last = SS(sci, SCI_GETFIRSTVISIBLELINE, 0, 0) +
+		              SS(sci, SCI_LINESONSCREEN, 0, 0);
+		return buffer->LineStart(SS(sci, SCI_DOCLINEFROMVISIBLE, last, 0) + 1);
+	}
+
+	/**
+	 * Applies the styles, fold levels, and line states a background job
+	 * produced so far to the document, up to the line start at or after
+	 * *endPos*. Everything ready up to *visibleEnd* is applied at once; past
+	 * it, at most *limit* bytes are applied per call, so idle calls styling the
+	 * rest of the document stay short.
+	 * The job is cancelled instead if the document's text no longer matches
+	 * the job's copy of it.
+	 * @param buffer The document interface.
+	 * @param endPos The position styles are needed up to.
+	 * @param visibleEnd The position the view shows text up to.
+	 * @param limit The most bytes to style past *visibleEnd*.
+	 */
+	void MergeJob(IDocument *buffer, Sci_PositionU endPos,
+	              Sci_PositionU visibleEnd, size_t limit) {
+		l_Snapshot &doc = job->doc;
+		size_t ready = job->ready, end = ready, bound = job->merged;
+		if (endPos > job->start && endPos - job->start < end)
+			end = endPos - job->start;
+		if (visibleEnd > job->start && visibleEnd - job->start > bound)
+			bound = visibleEnd - job->start;
+		if (end > bound + limit) end = bound + limit;
+		if (end < ready) end = doc.LineStart(doc.LineFromPosition(end - 1) + 1);
+		if (end <= job->merged) return;
+		Sci_PositionU pos = job->start + job->merged;
+		size_t len = end - job->merged;
+		if (pos + len > static_cast<Sci_PositionU>(buffer->Length()) ||
+		    memcmp(buffer->BufferPointer() + pos, doc.text.data() + job->merged,
+		           len) != 0)
+			return CancelJob(); // stale
+		std::lock_guard<std::mutex> guard(doc.lock);
+		buffer->StartStyling(pos, '\377');
+		buffer->SetStyles(len, &doc.styles[job->merged]);
+		Sci_Position line = doc.LineFromPosition(job->merged),
+		             end_line = doc.LineFromPosition(end),
+		             level_end = end_line;
+		if (end == doc.text.size()) {
+			// The last line is complete, and folding it leveled the line after it.
+			if (static_cast<size_t>(doc.LineStart(end_line)) < end) end_line++;
+			level_end = std::min(end_line + 1,
+			                     static_cast<Sci_Position>(doc.levels.size()));
+		}
+		if (doc.line_states_set)
+			for (Sci_Position i = line; i < end_line; i++)
+				buffer->SetLineState(job->first_line + i, doc.line_states[i]);
+		// Folding a line can change the levels of lines before it.
+		for (Sci_Position i = std::min(doc.level_low, line); i < level_end; i++)
+			buffer->SetLevel(job->first_line + i, doc.levels[i]);
+		doc.level_low = level_end;
+		job->merged = end;
+	}
+
+	/**
+	 * Handles a lex call with the background job, if possible.
+	 * Calls that continue from where the job's styles were applied up to apply
+	 * more of them; a job that finished is followed by the next one in its
+	 * chain. Other calls cancel the job. Then, for ranges larger than the
+	 * "lexer.lpeg.background" property, the start of the range is lexed now and
+	 * a new job lexes the rest.
+	 * @return `true` if the call was handled
+	 */
+	bool LexInBackground(LexAccessor &styler, IDocument *buffer,
+	                     Sci_PositionU startPos, Sci_Position lengthDoc,
+	                     int initStyle, bool by_line) {
+		ReapJobs();
+		Sci_PositionU endPos = startPos + lengthDoc;
+		int size = props.GetInt("lexer.lpeg.background");
+		bool chained = false, moved = false;
+		if (job && startPos == job->start + job->merged) {
+			MergeJob(buffer, endPos, VisibleEnd(buffer),
+			         size > 0 ? size : BACKGROUND_CHUNKSIZE);
+			if (job && !JobFinished()) return (fold_end = fold_start, true);
+			if (job) {
+				// Continue from where the finished job's results end.
+				Sci_PositionU styled = job->start + job->merged;
+				chained = styled < job_end, moved = true;
+				TraceJob(*job), job->thread.join(), job.reset();
+				if (styled >= endPos) return (fold_end = fold_start, true);
+				startPos = styled, initStyle = styler.StyleAt(styled - 1);
+			}
+		} else CancelJob();
+		if (!own_lua || size <= 0) return false;
+		Sci_PositionU syncEnd = startPos;
+		if (!chained)
+			syncEnd = buffer->LineStart(buffer->LineFromPosition(startPos + size) + 1);
+		else if (endPos - startPos <= static_cast<Sci_PositionU>(size))
+			syncEnd = endPos;
+		if (syncEnd >= endPos && !moved) return false;
+		if (syncEnd > endPos) syncEnd = endPos;
+		if (syncEnd > startPos) {
+			// Fold now; the job starts from the fold levels this leaves.
+			Lex(startPos, syncEnd - startPos, initStyle, buffer);
+			Fold(startPos, syncEnd - startPos, initStyle, buffer);
+		}
+		if (syncEnd < endPos) StartJob(styler, buffer, syncEnd, endPos, by_line);
+		return (fold_end = fold_start, true);
+	}
+
+	/**
+	 * Lexes from *startPos* up to *endPos* with a lexer without a `_LEXBYLINE`
+	 * flag and styles the tokens matched.
+	 * Unless *last* is `true`, the range is a window of a larger one, and only
+	 * the tokens before the last token boundary at least `LEX_WINDOWMARGIN`
+	 * bytes before *endPos* are styled, since the tokens after it may match
+	 * differently once more text follows. The boundary must also be the start
+	 * of a line, since patterns may depend on that, and for multilang lexers,
+	 * be followed by a whitespace token, whose style tells the next window
+	 * which language to start in.
+	 * @param styler The accessor to style with.
+	 * @param buffer The document interface.
+	 * @param startPos The position to start lexing at.
+	 * @param endPos The position to stop lexing at.
+	 * @param last Whether or not the range ends where lexing does.
+	 * @param initStyle The style to start lexing with. It is updated to the
+	 *   style to start the next window with.
+	 * @param styledEnd Set to the position styled up to, which is *startPos*
+	 *   if the window has no such boundary.
+	 * @return `false` on error
+	 */
+	bool LexWindow(LexAccessor &styler, IDocument *buffer, Sci_PositionU startPos,
+	               Sci_PositionU endPos, bool last, int &initStyle,
+	               Sci_PositionU &styledEnd) {
+		Sci_PositionU startSeg = startPos, endSeg = endPos;
+		int style = 0;
+		// Multilang lexers rebuild their grammar to start in another language.
+		l_getlexerfield(L, "_GRAMMAR");
+		const void *grammar = lua_topointer(L, -1);
+		lua_pop(L, 1); // _GRAMMAR
+		double mark = l_clock();
+		l_getlexerfield(L, "lex")
+		if (!lua_isfunction(L, -1))
+			return (l_error(L, "'lexer.lex' function not found"), false);
+		l_getlexerobj(L);
+		lua_pushlstring(L, buffer->BufferPointer() + startPos, endPos - startPos);
+		lua_pushinteger(L, initStyle);
+		if (lua_pcall(L, 3, 1, 0) != LUA_OK) return (l_error(L), false);
+		if (!lua_istable(L, -1))
+			return (l_error(L, "Table of tokens expected from 'lexer.lex'"), false);
+		double start = mark;
+		stats.lua_time += l_lap(mark), stats.bytes_lexed += endPos - startPos;
+		l_getlexerfield(L, "_GRAMMAR");
+		bool rebuilt = lua_topointer(L, -1) != grammar;
+		lua_pop(L, 1); // _GRAMMAR
+		if (rebuilt) stats.grammar_builds++;
+		if (LPegTrace *trace = Tracer())
+			trace->Add(rebuilt ? "lexer.lex, grammar rebuilt" : "lexer.lex", "lua",
+			           start, mark);
+		int len = static_cast<int>(lua_rawlen(L, -1));
+		l_getlexerfield(L, "_TOKENSTYLES");
+		if (!last) {
+			// Find the last boundary to stop at, looking backwards from the end.
+			const char *text = buffer->BufferPointer();
+			int next_style = -1, n = len;
+			len = 0, endSeg = startPos;
+			for (int i = n - 1; i >= 1; i -= 2) {
+				lua_rawgeti(L, -2, i + 1); // pos
+				Sci_PositionU position = startPos + lua_tointeger(L, -1) - 1;
+				lua_pop(L, 1); // pos
+				if (next_style >= 0 && position + LEX_WINDOWMARGIN <= endPos &&
+				    text[position - 1] == '\n' && (!multilang || ws[next_style])) {
+					len = i + 1, endSeg = position, initStyle = next_style;
+					break;
+				}
+				lua_rawgeti(L, -2, i), lua_rawget(L, -2); // _TOKENSTYLES[token]
+				next_style = lua_isnil(L, -1) ? STYLE_DEFAULT : lua_tointeger(L, -1);
+				lua_pop(L, 1); // _TOKENSTYLES[token]
+				if (next_style < 0 || next_style > STYLE_MAX) next_style = 0;
+			}
+		}
+		// Style the text from the token table returned.
+		if (len > 0) {
+			styler.StartAt(startPos);
+			styler.StartSegment(startPos);
+			// Loop through token-position pairs.
+			for (int i = 1; i < len; i += 2) {
+				style = STYLE_DEFAULT;
+				lua_rawgeti(L, -2, i), lua_rawget(L, -2); // _TOKENSTYLES[token]
+				if (!lua_isnil(L, -1)) style = lua_tointeger(L, -1);
+				lua_pop(L, 1); // _TOKENSTYLES[token]
+				lua_rawgeti(L, -2, i + 1); // pos
+				unsigned int position = lua_tointeger(L, -1) - 1;
+				lua_pop(L, 1); // pos
+				if (style >= 0 && style <= STYLE_MAX)
+					styler.ColourTo(startSeg + position - 1, style);
+				else
+					l_error(L, "Bad style number");
+				if (position > endSeg) break;
+			}
+			styler.ColourTo(endSeg - 1, style);
+			styler.Flush();
+			stats.tokens += len / 2;
+		}
+		lua_pop(L, 2); // _TOKENSTYLES and token table returned
+		stats.style_time += l_lap(mark);
+		styledEnd = endSeg;
+		return true;
+	}
+
+	/**
+	 * Lexes from *startPos* up to *endPos*.
+	 * Ranges larger than `LEX_WINDOW` are lexed one window at a time, with each
+	 * window starting where the last one stopped styling, so the memory used
+	 * for the copy of the text and its token table stays bounded.
+	 * @param styler The accessor to style with.
+	 * @param buffer The document interface.
+	 * @param startPos The position to start lexing at, as returned by
+	 *   `LexStart()`.
+	 * @param endPos The position to stop lexing at.
+	 * @param by_line Whether or not the lexer is a line lexer.
+	 */
+	void LexRange(LexAccessor &styler, IDocument *buffer, Sci_PositionU startPos,
+	              Sci_PositionU endPos, bool by_line) {
+		int top = BeginCall();
+		if (by_line) {
+			LexByLine(styler, buffer, startPos, endPos);
+			EndCall(top);
+			return;
+		}
+		int style = styler.StyleAt(startPos);
+		Sci_PositionU window = LEX_WINDOW;
+		while (startPos < endPos) {
+			Sci_PositionU end = (endPos - startPos > window) ? startPos + window :
+			                    endPos, next = startPos;
+			if (!LexWindow(styler, buffer, startPos, end, end == endPos, style,
+			               next))
+				break;
+			if (next > startPos)
+				startPos = next, window = LEX_WINDOW;
+			else
+				window *= 2; // a token spans the window
+			CollectIfGrown(); // the last window's text and tokens are garbage
+		}
+		EndCall(top);
+	}
+
+	/**
+	 * Lexes and folds from *startPos* up to *endPos* one piece at a time until
+	 * the milliseconds in the "lexer.lpeg.slice" property are used up.
+	 * The rest of the range is left unstyled, so Scintilla asks for it again,
+	 * for example when styling in idle time. Pieces end at line starts and
+	 * grow, at most twice as large as the last one, to fit the time left at
+	 * the speed the previous pieces took. A single LPeg match cannot be
+	 * suspended, so the last piece can overrun the slice.
+	 * @param styler The accessor to style with.
+	 * @param buffer The document interface.
+	 * @param startPos The position to start lexing at.
+	 * @param endPos The position to stop lexing at.
+	 * @param initStyle The style before *startPos*.
+	 * @param by_line Whether or not the lexer is a line lexer.
+	 */
+	void LexSliced(LexAccessor &styler, IDocument *buffer,
+	               Sci_PositionU startPos, Sci_PositionU endPos, int initStyle,
+	               bool by_line) {
+		double slice = props.GetInt("lexer.lpeg.slice"), begin = l_clock();
+		double elapsed = 0;
+		Sci_PositionU pos = startPos, piece = SLICE_FIRSTPIECE;
+		while (pos < endPos && elapsed < slice) {
+			Sci_PositionU end = std::min(endPos, static_cast<Sci_PositionU>(
+				buffer->LineStart(buffer->LineFromPosition(pos + piece) + 1)));
+			int style = pos > startPos ? styler.StyleAt(pos - 1) : initStyle;
+			LexRange(styler, buffer, LexStart(styler, buffer, pos, style, by_line),
+			         end, by_line);
+			// Fold here too, since Scintilla folds the whole range afterwards.
+			fold_start = pos, fold_end = end;
+			Fold(pos, end - pos, style, buffer);
+			pos = end, elapsed = l_clock() - begin;
+			double rate = (pos - startPos) / std::max(elapsed, 0.001);
+			piece = std::max(std::min(static_cast<Sci_PositionU>(
+				rate * std::max(slice - elapsed, 0.0)), 2 * piece),
+				static_cast<Sci_PositionU>(SLICE_FIRSTPIECE));
+		}
+		fold_end = fold_start;
+	}
+
+	/**
+	 * Lexes no more than the last *size* bytes up to *endPos*, from the start of
+	 * a line, and styles the rest of the range from *startPos* in the default
+	 * style, for documents too large to lex as a whole.
+	 * Scintilla asks for styles up to the end of what is shown, so only the
+	 * parts of the document that were in view when they were first reached
+	 * are lexed. Tokens that began before them are lexed from the middle.
+	 * @param styler The accessor to style with.
+	 * @param buffer The document interface.
+	 * @param startPos The position to start styling at.
+	 * @param endPos The position to stop lexing at.
+	 * @param initStyle The style before *startPos*.
+	 * @param size The "lexer.lpeg.viewport" property.
+	 * @param by_line Whether or not the lexer is a line lexer.
+	 */
+	void LexViewport(LexAccessor &styler, IDocument *buffer,
+	                 Sci_PositionU startPos, Sci_PositionU endPos, int initStyle,
+	                 Sci_PositionU size, bool by_line) {
+		CancelJob();
+		Sci_PositionU limit = endPos > size ?
+			buffer->LineStart(buffer->LineFromPosition(endPos - size)) : 0;
+		if (limit > startPos) {
+			styler.StartAt(startPos);
+			styler.StartSegment(startPos);
+			styler.ColourTo(limit - 1, STYLE_DEFAULT);
+			styler.Flush();
+			startPos = limit, initStyle = STYLE_DEFAULT, fold_start = limit;
+		}
+		LexRange(styler, buffer,
+		         LexStart(styler, buffer, startPos, initStyle, by_line, limit),
+		         endPos, by_line);
+	}
+
 public:
 	/** Constructor. */
-	LexerLPeg() : own_lua(true), reinit(true), multilang(false) {
+	LexerLPeg() : own_lua(true), reinit(true), multilang(false), gc_base(0),
+	              stats(), region(), line_cache_size(0), profile_period(0),
+	              load_report(), job_end(0), fold_start(0), fold_end(0) {
 		// Initialize the Lua state, load libraries, and set platform variables.
-		if ((L = luaL_newstate())) {
+		if ((L = lua_newstate(l_alloc, &region))) {
+			lua_atpanic(L, l_panic);
 			l_openlib(luaopen_base, LUA_BASELIBNAME);
 			l_openlib(luaopen_table, LUA_TABLIBNAME);
 			l_openlib(luaopen_string, LUA_STRLIBNAME);
@@ -526,6 +2447,7 @@ public:
 			lua_pushboolean(L, 1), lua_setglobal(L, "CURSES");
 #endif
 			lua_newtable(L), lua_setfield(L, LUA_REGISTRYINDEX, "sci_lexers");
+			gc_base = lua_gc(L, LUA_GCCOUNT, 0);
 		} else fprintf(stderr, "Lua failed to initialize.\n");
 		SS = NULL, sci = 0;
 	}
@@ -535,8 +2457,12 @@ public:
 
 	/** Destroys the lexer object. */
 	virtual void SCI_METHOD Release() {
+		StopWarmUp();
+		CancelJob();
+		for (auto &retired : retired_jobs) retired->thread.join();
+		WriteProfile();
 		if (own_lua && L)
-			lua_close(L);
+			lua_close(L), l_freeregion(&region);
 		else if (!own_lua) {
 			lua_getfield(L, LUA_REGISTRYINDEX, "sci_lexers");
 			lua_pushlightuserdata(L, reinterpret_cast<void *>(this));
@@ -555,7 +2481,10 @@ public:
 	 */
 	virtual void SCI_METHOD Lex(Sci_PositionU startPos, Sci_Position lengthDoc,
 	                            int initStyle, IDocument *buffer) {
+		LPegTraceScope scope(Tracer(), "Lex", "lexer");
 		LexAccessor styler(buffer);
+		stats.lex_calls++, stats.bytes_requested += lengthDoc;
+		fold_start = startPos, fold_end = startPos + lengthDoc;
 		if ((reinit && !Init()) || !L) {
 			// Style everything in the default style.
 			styler.StartAt(startPos);
@@ -584,54 +2513,27 @@ public:
 			return;
 		}
 
-		// Start from the beginning of the current style so LPeg matches it.
-		// For multilang lexers, start at whitespace since embedded languages have
-		// [lang]_whitespace styles. This is so LPeg can start matching child
-		// languages instead of parent ones if necessary.
-		if (startPos > 0) {
-			Sci_PositionU i = startPos;
-			while (i > 0 && styler.StyleAt(i - 1) == initStyle) i--;
-			if (multilang)
-				while (i > 0 && !ws[static_cast<size_t>(styler.StyleAt(i))]) i--;
-			lengthDoc += startPos - i, startPos = i;
-		}
+		// The "lexer.lpeg.by.line" property makes any lexer a line lexer.
+		l_getlexerfield(L, "_LEXBYLINE");
+		int by_line = lua_toboolean(L, -1) || props.GetInt("lexer.lpeg.by.line");
+		lua_pop(L, 1); // _LEXBYLINE
 
-		Sci_PositionU startSeg = startPos, endSeg = startPos + lengthDoc;
-		int style = 0;
-		l_getlexerfield(L, "lex")
-		if (lua_isfunction(L, -1)) {
-			l_getlexerobj(L);
-			lua_pushlstring(L, buffer->BufferPointer() + startPos, lengthDoc);
-			lua_pushinteger(L, styler.StyleAt(startPos));
-			if (lua_pcall(L, 3, 1, 0) != LUA_OK) l_error(L);
-			// Style the text from the token table returned.
-			if (lua_istable(L, -1)) {
-				size_t len = lua_rawlen(L, -1);
-				if (len > 0) {
-					styler.StartAt(startPos);
-					styler.StartSegment(startPos);
-					l_getlexerfield(L, "_TOKENSTYLES");
-					// Loop through token-position pairs.
-					for (int i = 1; i < static_cast<int>(len); i += 2) {
-						style = STYLE_DEFAULT;
-						lua_rawgeti(L, -2, i), lua_rawget(L, -2); // _TOKENSTYLES[token]
-						if (!lua_isnil(L, -1)) style = lua_tointeger(L, -1);
-						lua_pop(L, 1); // _TOKENSTYLES[token]
-						lua_rawgeti(L, -2, i + 1); // pos
-						unsigned int position = lua_tointeger(L, -1) - 1;
-						lua_pop(L, 1); // pos
-						if (style >= 0 && style <= STYLE_MAX)
-							styler.ColourTo(startSeg + position - 1, style);
-						else
-							l_error(L, "Bad style number");
-						if (position > endSeg) break;
-					}
-					lua_pop(L, 2); // _TOKENSTYLES and token table returned
-					styler.ColourTo(endSeg - 1, style);
-					styler.Flush();
-				}
-			} else l_error(L, "Table of tokens expected from 'lexer.lex'");
-		} else l_error(L, "'lexer.lex' function not found");
+		int viewport = props.GetInt("lexer.lpeg.viewport");
+		if (viewport > 0)
+			return LexViewport(styler, buffer, startPos, startPos + lengthDoc,
+			                   initStyle, viewport, by_line);
+
+		if (LexInBackground(styler, buffer, startPos, lengthDoc, initStyle,
+		                    by_line))
+			return;
+
+		Sci_PositionU endPos = startPos + lengthDoc;
+		if (props.GetInt("lexer.lpeg.slice") > 0 &&
+		    (!own_lua || props.GetInt("lexer.lpeg.background") <= 0))
+			return LexSliced(styler, buffer, startPos, endPos, initStyle, by_line);
+		LexRange(styler, buffer,
+		         LexStart(styler, buffer, startPos, initStyle, by_line), endPos,
+		         by_line);
 	}
 
 	/**
@@ -643,13 +2545,33 @@ public:
 	 */
 	virtual void SCI_METHOD Fold(Sci_PositionU startPos, Sci_Position lengthDoc,
 	                             int initStyle, IDocument *buffer) {
+		LPegTraceScope scope(Tracer(), "Fold", "lexer");
+		stats.fold_calls++;
 		if ((reinit && !Init()) || !L) return;
+		// Only fold what the last lex call did not leave to a background job.
+		Sci_PositionU endPos = std::min(startPos + lengthDoc, fold_end);
+		startPos = std::max(startPos, fold_start);
+		if (startPos >= endPos) return;
+		lengthDoc = endPos - startPos;
+		LexAccessor styler(buffer);
+
+		if (!props.GetInt("fold", 1)) {
+			// Reset fold levels like the lexer module's `fold()`, without handing
+			// it a copy of the text.
+			Sci_Position line = styler.GetLine(startPos);
+			Sci_Position lastLine = styler.GetLine(endPos);
+			int level = styler.LevelAt(line) & SC_FOLDLEVELNUMBERMASK;
+			for (; line < lastLine; line++)
+				if (styler.LevelAt(line) != level) styler.SetLevel(line, level);
+			return;
+		}
+
 		lua_pushlightuserdata(L, reinterpret_cast<void *>(&props));
 		lua_setfield(L, LUA_REGISTRYINDEX, "sci_props");
 		lua_pushlightuserdata(L, reinterpret_cast<void *>(buffer));
 		lua_setfield(L, LUA_REGISTRYINDEX, "sci_buffer");
-		LexAccessor styler(buffer);
 
+		int top = BeginCall();
 		l_getlexerfield(L, "fold");
 		if (lua_isfunction(L, -1)) {
 			l_getlexerobj(L);
@@ -658,7 +2580,9 @@ public:
 			lua_pushinteger(L, startPos);
 			lua_pushinteger(L, currentLine);
 			lua_pushinteger(L, styler.LevelAt(currentLine) & SC_FOLDLEVELNUMBERMASK);
+			double mark = l_clock();
 			if (lua_pcall(L, 5, 1, 0) != LUA_OK) l_error(L);
+			stats.lua_time += l_lap(mark);
 			// Fold the text from the fold table returned.
 			if (lua_istable(L, -1)) {
 				lua_pushnil(L);
@@ -667,8 +2591,10 @@ public:
 					lua_pop(L, 1); // level
 				}
 				lua_pop(L, 1); // fold table returned
+				stats.style_time += l_lap(mark);
 			} else l_error(L, "Table of folds expected from 'lexer.fold'");
 		} else l_error(L, "'lexer.fold' function not found");
+		EndCall(top);
 	}
 
 	/** Returning the version of the lexer is not implemented. */
@@ -691,6 +2617,15 @@ public:
 	virtual Sci_Position SCI_METHOD PropertySet(const char *key,
 	                                            const char *value) {
 		props.Set(key, *value ? value : " "); // ensure property is cleared
+		auto it = std::find_if(prop_values.begin(), prop_values.end(),
+		                       [key](const std::pair<std::string, std::string> &p) {
+			return p.first == key;
+		});
+		if (it != prop_values.end())
+			it->second = props.Get(key);
+		else
+			prop_values.push_back(std::make_pair(key, props.Get(key)));
+		CancelJob(); // its styles may no longer apply
 		if (reinit) Init();
 #if NO_SCITE
 		else if (L && SS && sci && strncmp(key, "style.", 6) == 0) {
@@ -715,7 +2650,9 @@ public:
 	/**
 	 * Allows for direct communication between the application and the lexer.
 	 * The application uses this to set `SS`, `sci`, `L`, and lexer properties,
-	 * and to retrieve style names.
+	 * to retrieve style names, statistics, profiles, and load reports, to
+	 * collect garbage when idle, to poll background lexing, to initialize
+	 * lexers ahead of time, and to reload lexers whose files changed.
 	 * @param code The communication code.
 	 * @param arg The argument.
 	 * @return void *data
@@ -731,7 +2668,7 @@ public:
 			sci = lParam;
 			return NULL;
 		case SCI_CHANGELEXERSTATE:
-			if (own_lua) lua_close(L);
+			if (own_lua) lua_close(L), l_freeregion(&region);
 			L = reinterpret_cast<lua_State *>(lParam);
 			lua_getfield(L, LUA_REGISTRYINDEX, "sci_lexers");
 			if (lua_isnil(L, -1))
@@ -772,6 +2709,42 @@ public:
 			return StringResult(lParam, val ? val : "null");
 		case SCI_GETSTATUS:
 			return StringResult(lParam, props.Get("lexer.lpeg.error"));
+		case LPEG_GCSTEP: {
+			LPegTraceScope scope(Tracer(), "collect garbage step", "lexer");
+			return reinterpret_cast<void *>(L && StepGC(static_cast<int>(lParam)));
+		}
+		case LPEG_GETSTATISTICS:
+			if (lParam) memcpy(arg, &UpdateStatistics(), sizeof(LPegStatistics));
+			return reinterpret_cast<void *>(sizeof(LPegStatistics));
+		case LPEG_GETSTATISTICSTEXT:
+			return StringResult(lParam, StatisticsText().c_str());
+		case LPEG_GETPROFILE:
+			return StringResult(lParam, ProfileText().c_str());
+		case LPEG_GETTRACE:
+			return StringResult(lParam, l_trace.Json().c_str());
+		case LPEG_GETLOADREPORT:
+			if (lParam) memcpy(arg, &load_report, sizeof(LPegLoadReport));
+			return reinterpret_cast<void *>(sizeof(LPegLoadReport));
+		case LPEG_BACKGROUND:
+			ReapJobs();
+			return reinterpret_cast<void *>(job ? 1 : 0);
+		case LPEG_RELOAD:
+			return reinterpret_cast<void *>(
+				arg && Reload(reinterpret_cast<const char *>(arg)) ? 1 : 0);
+		case LPEG_PREWARM: {
+			if (warmup) warmup->cancel = true, warmup->thread.join();
+			warmup = std::make_shared<l_Warmup>();
+			for (const char *p = reinterpret_cast<const char *>(arg); p && *p;) {
+				const char *end = strchr(p, ';');
+				if (!end) end = p + strlen(p);
+				if (end > p) warmup->languages.push_back(std::string(p, end));
+				p = *end ? end + 1 : end;
+			}
+			for (const auto &prop : prop_values)
+				if (prop.first != "lexer.name") warmup->props.push_back(prop);
+			warmup->thread = std::thread(WarmUp, warmup.get(), this);
+			return NULL;
+		}
 		default: // style-related
 			if (code >= -STYLE_MAX && code < 0) { // retrieve SciTE style strings
 #if !NO_SCITE
@@ -0,0 +1,163 @@
+/**
+ * Copyright 2006-2017 Mitchell mitchell.att.foicica.com.
+ * This file is distributed under Scintilla's license.
+ *
+ * Private call codes and structures shared between the LPeg lexer and the
+ * applications that host it.
+ * Codes are passed as the operation of `SCI_PRIVATELEXERCALL`. They lie
+ * outside the range of style numbers and Scintilla messages the lexer already
+ * recognizes.
+ */
+
+#ifndef LEXLPEG_H
+#define LEXLPEG_H
+
+/**
+ * Runs incremental Lua garbage collection steps for at most *arg*
+ * milliseconds.
+ * Applications should send this when idle. Returns non-zero if a collection
+ * cycle completed.
+ */
+#define LPEG_GCSTEP 9000
+/**
+ * Copies the lexer's `LPegStatistics` into the structure pointed to by *arg*.
+ * Returns the size of the structure.
+ */
+#define LPEG_GETSTATISTICS 9001
+/**
+ * Copies the Lua call stacks sampled by the profiler so far into the buffer
+ * pointed to by *arg*, one "frame;frame;... count" line per distinct stack
+ * (the collapsed format flame graph tools read).
+ * If *arg* is `NULL`, returns the size of the buffer needed.
+ */
+#define LPEG_GETPROFILE 9002
+/**
+ * Copies the `LPegLoadReport` of the lexer's last initialization into the
+ * structure pointed to by *arg*.
+ * Returns the size of the structure.
+ */
+#define LPEG_GETLOADREPORT 9003
+/**
+ * Returns non-zero while a background thread is lexing part of the document
+ * or has styles that were not applied yet.
+ * Ranges larger than the "lexer.lpeg.background" property are lexed in the
+ * background. Their styles are applied by lex calls that start where the
+ * styled part of the document ends, so applications should then periodically
+ * send `SCI_COLOURISE` from `SCI_GETENDSTYLED` to the end of the document.
+ * Such a call applies every ready style up to the end of the view, and at most
+ * "lexer.lpeg.background" bytes of styles past it.
+ */
+#define LPEG_BACKGROUND 9004
+/**
+ * Copies the lexer's statistics as "name=value" lines into the buffer pointed
+ * to by *arg*, for applications that log or display them rather than read the
+ * `LPegStatistics` fields.
+ * If *arg* is `NULL`, returns the size of the buffer needed.
+ */
+#define LPEG_GETSTATISTICSTEXT 9005
+/**
+ * Copies the trace events LPeg lexers recorded into the buffer pointed to by
+ * *arg*, as comma-separated Chrome trace event objects (see `LPegTrace.h`).
+ * All lexers share one trace, which keeps the number of most recent events in
+ * the "lexer.lpeg.trace" property. A value of `0` records none.
+ * If *arg* is `NULL`, returns the size of the buffer needed.
+ */
+#define LPEG_GETTRACE 9006
+/**
+ * Starts loading the lexers of the ';'-separated languages in the string
+ * pointed to by *arg* on a background thread, with the lexer's properties
+ * (e.g. "lexer.lpeg.home" and "lexer.lpeg.color.theme").
+ * The first lexer created afterwards for one of the languages with the same
+ * home and theme takes over its Lua state, so its grammar is already compiled
+ * when it is first applied. Lexers no lexer took over are released with the
+ * lexer that loaded them. A lexer applications keep for this purpose should
+ * not be given a language itself.
+ */
+#define LPEG_PREWARM 9007
+/**
+ * Loads the lexer named by the string pointed to by *arg*, whose file changed,
+ * and the lexers that embed it, again the next time they are needed, without
+ * loading the lexer module and theme again.
+ * Returns non-zero if the lexer's language was one of them, in which case it
+ * was re-initialized and applications should lex its document again.
+ */
+#define LPEG_RELOAD 9008
+
+/** Statistics kept by an LPeg lexer instance. */
+struct LPegStatistics {
+	/** Milliseconds spent collecting Lua garbage. */
+	double gc_time;
+	/** The number of completed garbage collection cycles. */
+	int gc_cycles;
+	/** Bytes held by the scratch region lexing and folding allocate from. */
+	size_t region_size;
+	/** The number of lines a line lexer styled from the line cache. */
+	size_t line_cache_hits;
+	/** The number of lines a line lexer had to lex. */
+	size_t line_cache_misses;
+	/** The number of Lua call stacks the profiler sampled. */
+	size_t profile_samples;
+	/** The number of lex calls. */
+	size_t lex_calls;
+	/** The number of fold calls. */
+	size_t fold_calls;
+	/** The number of bytes lex calls were asked to style. */
+	size_t bytes_requested;
+	/**
+	 * The number of bytes handed to the grammar. This exceeds `bytes_requested`
+	 * by what was lexed again to start at a token or line boundary, less what
+	 * came from the line cache or was left to background threads.
+	 */
+	size_t bytes_lexed;
+	/** The number of tokens styled. */
+	size_t tokens;
+	/** Milliseconds spent in Lua lexing and folding. */
+	double lua_time;
+	/** Milliseconds spent applying styles and fold levels. */
+	double style_time;
+	/** The number of times a grammar was built, including by initialization. */
+	size_t grammar_builds;
+	/** The number of times the lexer was (re-)initialized. */
+	size_t inits;
+	/** Bytes of memory used by the lexer's Lua state. */
+	long long lua_memory;
+	/** The number of languages whose lexers the Lua state keeps loaded. */
+	size_t lexers_cached;
+	/** Bytes of memory the compiled grammars of those lexers take. */
+	long long lexer_cache_memory;
+	/**
+	 * The bytes of memory loaded lexers may take before the least recently used
+	 * ones are dropped, from the "lexer.lpeg.lexer.cache" property (in KB), or
+	 * `0` for no limit.
+	 */
+	long long lexer_cache_budget;
+	/** The number of lexers dropped to stay within the budget. */
+	size_t lexer_evictions;
+};
+
+/** What initializing an LPeg lexer for a language cost. */
+struct LPegLoadReport {
+	/**
+	 * Milliseconds spent loading the lexer module, or `0` if it was already
+	 * loaded.
+	 */
+	double module_time;
+	/** Milliseconds spent loading the theme. */
+	double theme_time;
+	/** Milliseconds spent in `lexer.load()`, including any child lexers. */
+	double load_time;
+	/** Milliseconds spent setting styles and finding whitespace styles. */
+	double styles_time;
+	/** Milliseconds spent compiling the grammar. */
+	double compile_time;
+	/** The number of nodes in the grammar's pattern tree. */
+	size_t tree_size;
+	/** The number of instructions in the compiled grammar. */
+	size_t code_size;
+	/** The number of Lua values the grammar refers to. */
+	size_t ktable_size;
+	/** The change in bytes of memory used by the lexer's Lua state. */
+	long long memory_delta;
+};
+
+#endif
@@ -886,9 +886,69 @@ local lpeg_match = lpeg.match
 
 M.LEXERPATH = package.path
 
+-- The number of lexers loaded with the `cache` flag that are cached, the KB
+-- their compiled grammars take, and the number of lexers dropped from the
+-- cache to stay within its memory budget.
+M._LEXERS, M._LEXERMEMORY, M._EVICTIONS = 0, 0, 0
+
 -- Table of loaded lexers.
 local lexers = {}
 
+-- The lexers loaded with the `cache` flag of `M.load()`, least recently
+-- used first. Each entry holds the `name` of the lexer, the `names` of all of
+-- the lexers loading it added to `lexers`, and the `size` in KB of its
+-- grammar's tree and compiled code, or `0` if it was loaded without a budget.
+local loaded = {}
+
+-- Moves the entries in `loaded` that loaded lexer name *name* to the end, in
+-- order.
+local function touch_lexer(name)
+  local touched = {}
+  for i = #loaded, 1, -1 do
+    local names = loaded[i].names
+    for j = 1, #names do
+      if names[j] == name then
+        table.insert(touched, 1, table.remove(loaded, i))
+        break
+      end
+    end
+  end
+  for i = 1, #touched do loaded[#loaded + 1] = touched[i] end
+end
+
+-- Removes entry *i* from `loaded` and its lexers from `lexers`, except those
+-- that another entry also loaded, and returns the entry.
+local function drop_lexers(i)
+  local entry = table.remove(loaded, i)
+  for j = 1, #entry.names do
+    local name, shared = entry.names[j], false
+    for k = 1, #loaded do
+      for l = 1, #loaded[k].names do
+        if loaded[k].names[l] == name then shared = true break end
+      end
+    end
+    if not shared then lexers[name] = nil end
+  end
+  M._LEXERMEMORY = M._LEXERMEMORY - entry.size
+  M._LEXERS = #loaded
+  return entry
+end
+
+-- Removes the least recently used lexers from `lexers` until the rest take at
+-- most "lexer.lpeg.lexer.cache" KB of memory or only the most recently used
+-- one is left. A value of `0` keeps all lexers.
+local function evict_lexers()
+  local budget = M.property_int['lexer.lpeg.lexer.cache']
+  while budget > 0 and M._LEXERMEMORY > budget and #loaded > 1 do
+    drop_lexers(1)
+    M._EVICTIONS = M._EVICTIONS + 1
+  end
+  M._LEXERS = #loaded
+end
+
+-- The names the lexer being loaded with the `cache` flag added to `lexers`.
+local loading_names
+
 -- Keep track of the last parent lexer loaded. This lexer's rules are used for
 -- proxy lexers (those that load parent and child lexers to embed) that do not
 -- declare a parent lexer.
@@ -1025,21 +1085,65 @@ end
 -- @param cache Flag indicating whether or not to load lexers from the cache.
 --   This should only be `true` when initially loading a lexer (e.g. not from
 --   within another lexer for embedding purposes).
+--   The cache holds the lexers loaded this way, and those they load, within
+--   the memory budget of the "lexer.lpeg.lexer.cache" property in KB, if any.
+--   Each lexer is charged with the size of its compiled grammar. Least
+--   recently loaded lexers are dropped first and loaded again the next time.
 --   The default value is `false`.
 -- @return lexer object
 -- @name load
 function M.load(name, alt_name, cache)
-  if cache and lexers[alt_name or name] then return lexers[alt_name or name] end
+  if cache and lexers[alt_name or name] then
+    touch_lexer(alt_name or name)
+    return lexers[alt_name or name]
+  elseif cache then
+    local names, outer_names = {}, loading_names
+    loading_names = names
+    local ok, lexer = pcall(M.load, name, alt_name)
+    loading_names = outer_names
+    if not ok then error(lexer, 0) end
+    -- Lexers the load replaced in `lexers` are no longer kept by their entries.
+    for i = #loaded, 1, -1 do
+      for j = 1, #names do
+        if loaded[i].name == names[j] then
+          M._LEXERMEMORY = M._LEXERMEMORY - table.remove(loaded, i).size
+          break
+        end
+      end
+    end
+    -- Charge the lexer with its grammar's tree and compiled code, most of what
+    -- it keeps. Compiling the grammar here saves the first lex from doing so.
+    -- Without a budget nothing is ever dropped, so nothing is measured.
+    local size = 0
+    if M.property_int['lexer.lpeg.lexer.cache'] > 0 and lexer._GRAMMAR then
+      size = select(4, lpeg.footprint(lexer._GRAMMAR)) / 1024
+    end
+    loaded[#loaded + 1] = {name = alt_name or name, names = names, size = size}
+    M._LEXERMEMORY = M._LEXERMEMORY + size
+    evict_lexers()
+    return lexer
+  end
   parent_lexer = nil -- reset
 
-  -- When using Scintillua as a stand-alone module, the `property` and
-  -- `property_int` tables do not exist (they are not useful). Create them to
-  -- prevent errors from occurring.
+  -- When using Scintillua as a stand-alone module, the `property`,
+  -- `property_int`, and `property_expanded` tables do not exist (they are not
+  -- useful). Create them to prevent errors from occurring.
   if not M.property then
     M.property, M.property_int = {}, setmetatable({}, {
       __index = function(t, k) return tonumber(M.property[k]) or 0 end,
       __newindex = function() error('read-only property') end
     })
+    M.property_expanded = setmetatable({}, {
+      -- Returns the string property value associated with string property
+      -- *key*, replacing any "$()" and "%()" expressions with the values of
+      -- their keys.
+      __index = function(t, key)
+        return (M.property[key] or ''):gsub('[$%%]%b()', function(key)
+          return t[key:sub(3, -2)]
+        end)
+      end,
+      __newindex = function() error('read-only property') end
+    })
   end
 
   -- Load the language lexer with its rules, styles, etc.
@@ -1098,9 +1202,32 @@ function M.load(name, alt_name, cache)
 
   lexer.lex, lexer.fold = M.lex, M.fold
   lexers[alt_name or name] = lexer
+  if loading_names then loading_names[#loading_names + 1] = alt_name or name end
   return lexer
 end
 
+---
+-- Drops lexer name *name*, and the lexers that loaded it, from the cache so
+-- `lexer.load()` loads them again, e.g. after the lexer's file changed.
+-- @param name The name of the lexer.
+-- @return table of the names of the lexers loaded with the `cache` flag that
+--   were dropped
+-- @name unload
+function M.unload(name)
+  local unloaded = {}
+  for i = #loaded, 1, -1 do
+    local names = loaded[i].names
+    for j = 1, #names do
+      if names[j] == name then
+        unloaded[#unloaded + 1] = drop_lexers(i).name
+        break
+      end
+    end
+  end
+  lexers[name] = nil
+  return unloaded
+end
+
 ---
 -- Lexes a chunk of text *text* (that has an initial style number of
 -- *init_style*) with lexer *lexer*.
@@ -1391,6 +1518,7 @@ end
 --   l.nonnewline^0)
 -- @name starts_line
 function M.starts_line(patt)
+  if lpeg.linestart then return lpeg.linestart() * patt end
   return lpeg_Cmt(lpeg_C(patt), function(input, index, match, ...)
     local pos = index - #match
     if pos == 1 then return index, ... end
@@ -1408,6 +1536,7 @@ end
 --   l.delimited_range('/')
 -- @name last_char_includes
 function M.last_char_includes(s)
+  if lpeg.lastchar then return lpeg.lastchar(s) end
   s = '['..s:gsub('[-%%%[]', '%%%1')..']'
   return lpeg_P(function(input, index)
     if index == 1 then return index end
@@ -1433,6 +1562,10 @@ function M.nested_pair(start_chars, end_chars)
   return lpeg_P{s * (M.any - s - end_chars + lpeg_V(1))^0 * e}
 end
 
+-- The default word characters ("%w_" in Lua).
+local default_word_chars = '0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_'..
+                           'abcdefghijklmnopqrstuvwxyz'
+
 ---
 -- Creates and returns a pattern that matches any single word in list *words*.
 -- Words consist of alphanumeric and underscore characters, as well as the
@@ -1453,6 +1586,12 @@ end
 --   'bar-foo', 'bar-baz', 'baz-foo', 'baz-bar'}, '-', true))
 -- @name word_match
 function M.word_match(words, word_chars, case_insensitive)
+  -- The bundled LPeg looks words up in the VM itself, with no callback and no
+  -- per-word string.
+  if lpeg.keywords then
+    return lpeg.keywords(words, default_word_chars..(word_chars or ''),
+                         case_insensitive)
+  end
   local word_list = {}
   for i = 1, #words do
     word_list[case_insensitive and words[i]:lower() or words[i]] = true
@@ -1582,17 +1721,6 @@ function M.fold_line_comments(prefix)
   end
 end
 
-M.property_expanded = setmetatable({}, {
-  -- Returns the string property value associated with string property *key*,
-  -- replacing any "$()" and "%()" expressions with the values of their keys.
-  __index = function(t, key)
-    return M.property[key]:gsub('[$%%]%b()', function(key)
-      return t[key:sub(3, -2)]
-    end)
-  end,
-  __newindex = function() error('read-only property') end
-})
-
 --[[ The functions and fields below were defined in C.
 
 ---
@@ -17,7 +17,6 @@
 // Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 
 #include "Config.h"
-#include "Utilities.h"
 
 #include <Shlwapi.h>
 
@@ -50,37 +49,7 @@ void ConfigLoad(const NotepadPPGateway &npp, Configuration *config) {
 
 	if (file == nullptr) return;
 
-	config->file_extensions.clear();
-
-	char line[512];
-	while (true) {
-		if (fgets(line, 512, file) == NULL) break;
-
-		// Ignore comments and blank lines
-		if (line[0] == ';' || line[0] == '\r' || line[0] == '\n') continue;
-
-		std::string s(line);
-
-		auto key_value = split(s, '=');
-
-		// Just skip lines that aren't what we expect
-		if (key_value.size() != 2) continue;
-
-		trim(key_value[0]);
-		trim(key_value[1]);
-
-		// Handle some specific settings
-		if (key_value[0] == "theme") {
-			config->theme = key_value[1];
-			continue;
-		}
-		else if (key_value[0] == "override") {
-			config->over_ride = key_value[1] == "true";
-		}
-
-		// Anything else is assumed to be a language/extentsion pattern
-		config->file_extensions[key_value[0]] = split(key_value[1], ';');
-	}
+	ConfigParse(file, config);
 
 	fclose(file);
 }
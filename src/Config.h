@@ -20,16 +20,9 @@
 
 #include "PluginDefinition.h"
 #include "NotepadPPGateway.h"
+#include "ConfigParser.h"
 
-#include <map>
 #include <string>
-#include <vector>
-
-typedef struct Configuration {
-	bool over_ride;
-	std::string theme;
-	std::map<std::string, std::vector<std::string>> file_extensions;
-} Configuration;
 
 bool MatchWild(const char *pattern, size_t lenPattern, const char *fileName, bool caseSensitive);
 const wchar_t *GetIniFilePath(const NotepadPPGateway &npp);
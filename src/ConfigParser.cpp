@@ -0,0 +1,331 @@
+// This file is part of Scintillua++.
+// 
+// Copyright (C)2017 Justin Dailey <dail8859@yahoo.com>
+// 
+// Scintillua++ is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include "ConfigParser.h"
+#include "Utilities.h"
+
+#include <stdlib.h>
+
+// Patterns are tried like MatchWild() does: a pattern matches the whole file name, and
+// then a '*' at its start matches any beginning of the name, or else one at its end any
+// ending of it. Languages are tried in order, and each language's patterns in order.
+static void IndexFilePatterns(Configuration *config) {
+	FilePatternIndex &index = config->file_patterns;
+	index = FilePatternIndex();
+	index.longest_suffix = 0;
+	index.prefixes.push_back({ {}, std::string::npos });
+
+	for (const auto &kv : config->file_extensions) {
+		for (const auto &pattern : kv.second) {
+			size_t number = index.languages.size();
+			index.languages.push_back(kv.first);
+
+			// Earlier patterns take precedence, so only keep the first of the same ones
+			index.names.emplace(pattern, number);
+			if (pattern.empty()) continue;
+
+			if (pattern.front() == '*') {
+				index.suffixes.emplace(pattern.substr(1), number);
+				if (pattern.size() - 1 > index.longest_suffix) index.longest_suffix = pattern.size() - 1;
+			}
+			else if (pattern.back() == '*') {
+				size_t node = 0;
+				for (size_t i = 0; i + 1 < pattern.size(); ++i) {
+					auto search = index.prefixes[node].next.find(pattern[i]);
+					if (search == index.prefixes[node].next.end()) {
+						index.prefixes[node].next[pattern[i]] = index.prefixes.size();
+						node = index.prefixes.size();
+						index.prefixes.push_back({ {}, std::string::npos });
+					}
+					else {
+						node = search->second;
+					}
+				}
+				if (index.prefixes[node].pattern == std::string::npos)
+					index.prefixes[node].pattern = number;
+			}
+		}
+	}
+}
+
+// Returns the language of the first pattern the file name matches, or an empty string
+std::string LanguageFromFileName(const Configuration *config, const std::string &fileName) {
+	const FilePatternIndex &index = config->file_patterns;
+	size_t best = std::string::npos;
+
+	auto name = index.names.find(fileName);
+	if (name != index.names.end()) best = name->second;
+
+	if (!index.suffixes.empty()) {
+		size_t shortest = fileName.size() > index.longest_suffix ? fileName.size() - index.longest_suffix : 0;
+		for (size_t i = shortest; i <= fileName.size(); ++i) {
+			auto suffix = index.suffixes.find(fileName.substr(i));
+			if (suffix != index.suffixes.end() && suffix->second < best) best = suffix->second;
+		}
+	}
+
+	size_t node = 0;
+	for (size_t i = 0; node < index.prefixes.size(); ++i) {
+		const auto &prefix = index.prefixes[node];
+		if (prefix.pattern < best) best = prefix.pattern;
+		if (i == fileName.size()) break;
+
+		auto search = prefix.next.find(fileName[i]);
+		if (search == prefix.next.end()) break;
+		node = search->second;
+	}
+
+	return best != std::string::npos ? index.languages[best] : std::string("");
+}
+
+static char LowerCase(char ch) {
+	return (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch - 'A' + 'a') : ch;
+}
+
+// Interpreters of "#!" lines are looked up by name, signatures starting with '^' are
+// compared with the start of the text, and the rest are found by one Aho-Corasick automaton.
+// Signatures ignore ASCII case.
+static void IndexContentSignatures(Configuration *config) {
+	ContentIndex &index = config->content;
+	index = ContentIndex();
+	index.states.push_back({ {}, 0, std::string::npos });
+
+	for (const auto &kv : config->interpreters) {
+		for (const auto &interpreter : kv.second) {
+			if (interpreter.empty()) continue;
+			index.interpreters.emplace(interpreter, index.languages.size());
+			index.languages.push_back(kv.first);
+		}
+	}
+
+	for (const auto &kv : config->content_signatures) {
+		for (const auto &signature : kv.second) {
+			size_t number = index.languages.size();
+			index.languages.push_back(kv.first);
+
+			std::string lower(signature);
+			for (auto &ch : lower) ch = LowerCase(ch);
+
+			if (lower.size() > 1 && lower[0] == '^') {
+				index.anchored.emplace_back(lower.substr(1), number);
+				continue;
+			}
+			if (lower.empty()) continue;
+
+			size_t state = 0;
+			for (char ch : lower) {
+				auto search = index.states[state].next.find(ch);
+				if (search == index.states[state].next.end()) {
+					index.states[state].next[ch] = index.states.size();
+					state = index.states.size();
+					index.states.push_back({ {}, 0, std::string::npos });
+				}
+				else {
+					state = search->second;
+				}
+			}
+			if (index.states[state].rule == std::string::npos)
+				index.states[state].rule = number;
+		}
+	}
+
+	// Set the fail links breadth first, so the states they lead to are done first
+	std::vector<size_t> queue;
+	for (const auto &kv : index.states[0].next) queue.push_back(kv.second);
+	for (size_t i = 0; i < queue.size(); ++i) {
+		size_t state = queue[i];
+		for (const auto &kv : index.states[state].next) {
+			size_t fail = index.states[state].fail;
+			while (fail != 0 && index.states[fail].next.count(kv.first) == 0)
+				fail = index.states[fail].fail;
+
+			auto search = index.states[fail].next.find(kv.first);
+			size_t target = kv.second;
+			index.states[target].fail = (search != index.states[fail].next.end() && search->second != target) ? search->second : 0;
+			if (index.states[index.states[target].fail].rule < index.states[target].rule)
+				index.states[target].rule = index.states[index.states[target].fail].rule;
+
+			queue.push_back(target);
+		}
+	}
+}
+
+// Returns the name of the interpreter of a "#!" line, without a version, skipping "env"
+static std::string ShebangInterpreter(const char *text, size_t length) {
+	if (length < 2 || text[0] != '#' || text[1] != '!')
+		return std::string("");
+
+	size_t end = 2;
+	while (end < length && text[end] != '\r' && text[end] != '\n') ++end;
+
+	std::string interpreter;
+	size_t i = 2;
+	while (i < end) {
+		while (i < end && (text[i] == ' ' || text[i] == '\t')) ++i;
+		size_t start = i;
+		while (i < end && text[i] != ' ' && text[i] != '\t') ++i;
+
+		std::string word(text + start, i - start);
+		word = word.substr(word.find_last_of('/') + 1);
+		if (word.empty() || word[0] == '-' || word == "env")
+			continue;
+
+		interpreter = word;
+		break;
+	}
+
+	while (!interpreter.empty() && ((interpreter.back() >= '0' && interpreter.back() <= '9') || interpreter.back() == '.'))
+		interpreter.pop_back();
+
+	return interpreter;
+}
+
+// Returns the language the text starts like, or an empty string. A "#!" line takes precedence,
+// then signatures at the start of the text, then the signature that ends first.
+std::string LanguageFromContent(const Configuration *config, const char *text, size_t length) {
+	const ContentIndex &index = config->content;
+	if (index.languages.empty())
+		return std::string("");
+
+	auto interpreter = index.interpreters.find(ShebangInterpreter(text, length));
+	if (interpreter != index.interpreters.end())
+		return index.languages[interpreter->second];
+
+	size_t best = std::string::npos;
+	for (const auto &anchored : index.anchored) {
+		const std::string &signature = anchored.first;
+		if (anchored.second < best && signature.size() <= length) {
+			size_t i = 0;
+			while (i < signature.size() && LowerCase(text[i]) == signature[i]) ++i;
+			if (i == signature.size()) best = anchored.second;
+		}
+	}
+	if (best != std::string::npos)
+		return index.languages[best];
+
+	size_t state = 0;
+	for (size_t i = 0; i < length && index.states.size() > 1; ++i) {
+		char ch = LowerCase(text[i]);
+		auto search = index.states[state].next.find(ch);
+		while (state != 0 && search == index.states[state].next.end()) {
+			state = index.states[state].fail;
+			search = index.states[state].next.find(ch);
+		}
+		state = search != index.states[state].next.end() ? search->second : 0;
+
+		if (index.states[state].rule != std::string::npos)
+			return index.languages[index.states[state].rule];
+	}
+
+	return std::string("");
+}
+
+// The name of the behavior in "largefile.<name>" settings
+const char *LargeFileBehaviorName(LargeFileBehavior behavior) {
+	static const char *names[LARGEFILE_BEHAVIORS] = { "full", "nofold", "byline", "viewport", "plaintext" };
+
+	return names[behavior];
+}
+
+// Reads the settings from the file, replacing the languages and large file tiers read before
+void ConfigParse(FILE *file, Configuration *config) {
+	config->file_extensions.clear();
+	config->interpreters.clear();
+	config->content_signatures.clear();
+	for (auto &tier : config->large_files) tier = LargeFileTier();
+
+	char line[512];
+	while (true) {
+		if (fgets(line, 512, file) == NULL) break;
+
+		// Ignore comments and blank lines
+		if (line[0] == ';' || line[0] == '\r' || line[0] == '\n') continue;
+
+		std::string s(line);
+
+		auto key_value = split(s, '=');
+
+		// Content signatures can contain '=' themselves, as modelines do
+		if (key_value.size() > 2 && s.compare(0, 8, "content.") == 0) {
+			key_value = { key_value[0], s.substr(s.find('=') + 1) };
+		}
+
+		// Just skip lines that aren't what we expect
+		if (key_value.size() != 2) continue;
+
+		trim(key_value[0]);
+		trim(key_value[1]);
+
+		// Handle some specific settings
+		if (key_value[0] == "theme") {
+			config->theme = key_value[1];
+			continue;
+		}
+		else if (key_value[0] == "override") {
+			config->over_ride = key_value[1] == "true";
+		}
+		else if (key_value[0] == "profile") {
+			config->profile = atoi(key_value[1].c_str());
+			continue;
+		}
+		else if (key_value[0] == "background") {
+			config->background = atoi(key_value[1].c_str());
+			continue;
+		}
+		else if (key_value[0] == "slice") {
+			config->slice = atoi(key_value[1].c_str());
+			continue;
+		}
+		else if (key_value[0] == "trace") {
+			config->trace = atoi(key_value[1].c_str());
+			continue;
+		}
+		else if (key_value[0] == "lexercache") {
+			config->lexer_cache = atoi(key_value[1].c_str());
+			continue;
+		}
+		else if (key_value[0] == "sniff") {
+			config->sniff = atoi(key_value[1].c_str());
+			continue;
+		}
+		else if (key_value[0].compare(0, 12, "interpreter.") == 0) {
+			config->interpreters[key_value[0].substr(12)] = split(key_value[1], ';');
+			continue;
+		}
+		else if (key_value[0].compare(0, 8, "content.") == 0) {
+			config->content_signatures[key_value[0].substr(8)] = split(key_value[1], ';');
+			continue;
+		}
+		else if (key_value[0].compare(0, 10, "largefile.") == 0) {
+			auto thresholds = split(key_value[1], ';');
+			for (int i = LARGEFILE_NOFOLD; i < LARGEFILE_BEHAVIORS; ++i) {
+				if (key_value[0].compare(10, std::string::npos, LargeFileBehaviorName(static_cast<LargeFileBehavior>(i))) == 0) {
+					config->large_files[i].size = thresholds.size() > 0 ? atoll(thresholds[0].c_str()) : 0;
+					config->large_files[i].line_length = thresholds.size() > 1 ? atoi(thresholds[1].c_str()) : 0;
+				}
+			}
+			continue;
+		}
+
+		// Anything else is assumed to be a language/extentsion pattern
+		config->file_extensions[key_value[0]] = split(key_value[1], ';');
+	}
+
+	IndexFilePatterns(config);
+	IndexContentSignatures(config);
+}
@@ -0,0 +1,102 @@
+// This file is part of Scintillua++.
+// 
+// Copyright (C)2017 Justin Dailey <dail8859@yahoo.com>
+// 
+// Scintillua++ is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+// The parts of the settings that do not depend on Notepad++ or Windows, so the command line
+// tools read the same settings file the same way the plugin does.
+
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// How much of the lexing a large file gets, from the most to the least
+enum LargeFileBehavior {
+	LARGEFILE_FULL,
+	LARGEFILE_NOFOLD,
+	LARGEFILE_BYLINE,
+	LARGEFILE_VIEWPORT,
+	LARGEFILE_PLAINTEXT,
+	LARGEFILE_BEHAVIORS
+};
+
+// Files with at least this many bytes or a line with at least this many characters get
+// the tier's behavior. A threshold of 0 is never reached.
+typedef struct LargeFileTier {
+	long long size;
+	int line_length;
+} LargeFileTier;
+
+// The file name patterns of the languages, indexed so finding the language of a file name
+// takes time in the length of the name rather than the number of patterns. Patterns are
+// numbered in the order they are tried, and the lowest numbered match wins.
+typedef struct FilePatternIndex {
+	// A node of the trie of "prefix*" patterns
+	typedef struct PrefixNode {
+		std::unordered_map<char, size_t> next;
+		size_t pattern;
+	} PrefixNode;
+
+	std::unordered_map<std::string, size_t> names;
+	std::unordered_map<std::string, size_t> suffixes;
+	size_t longest_suffix;
+	std::vector<PrefixNode> prefixes;
+	std::vector<std::string> languages;
+} FilePatternIndex;
+
+// What the start of a file says about its language, for files whose names match no pattern.
+// Rules are numbered languages first, then each language's signatures in order.
+typedef struct ContentIndex {
+	// A state of the Aho-Corasick automaton finding the signatures anywhere in the text
+	typedef struct State {
+		std::unordered_map<char, size_t> next;
+		size_t fail;
+		// The lowest numbered signature ending here, including the ones the fail links lead to
+		size_t rule;
+	} State;
+
+	std::unordered_map<std::string, size_t> interpreters;
+	std::vector<std::pair<std::string, size_t>> anchored;
+	std::vector<State> states;
+	std::vector<std::string> languages;
+} ContentIndex;
+
+typedef struct Configuration {
+	bool over_ride;
+	std::string theme;
+	int profile;
+	int background;
+	int slice;
+	int trace;
+	int lexer_cache;
+	LargeFileTier large_files[LARGEFILE_BEHAVIORS];
+	std::map<std::string, std::vector<std::string>> file_extensions;
+	FilePatternIndex file_patterns;
+	int sniff;
+	std::map<std::string, std::vector<std::string>> interpreters;
+	std::map<std::string, std::vector<std::string>> content_signatures;
+	ContentIndex content;
+} Configuration;
+
+std::string LanguageFromFileName(const Configuration *config, const std::string &fileName);
+std::string LanguageFromContent(const Configuration *config, const char *text, size_t length);
+const char *LargeFileBehaviorName(LargeFileBehavior behavior);
+void ConfigParse(FILE *file, Configuration *config);
@@ -17,6 +17,7 @@
 // Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 
 #include <string>
+#include <vector>
 #include <fstream>
 #include <streambuf>
 
@@ -30,6 +31,9 @@
 #include "Utilities.h"
 #include "menuCmdID.h"
 #include "NotepadPPGateway.h"
+#include "ILexer.h"
+#include "LexLPeg.h"
+#include "LPegTrace.h"
 
 static HANDLE _hModule;
 static NppData nppData;
@@ -37,9 +41,24 @@ static Configuration config;
 static ScintillaGateway editor;
 static NotepadPPGateway npp;
 static std::map<uptr_t, std::string> bufferLanguages;
+static std::map<uptr_t, std::string> bufferStatistics;
+static std::map<uptr_t, std::pair<std::wstring, std::string>> bufferFileLanguages;
+static LPegTrace trace;
+static UINT_PTR idleTimer = 0;
+static HMODULE lexerLibrary = NULL;
+static ILexer *warmer = nullptr;
+static HANDLE lexerChanges = INVALID_HANDLE_VALUE;
+static std::map<std::string, ULONGLONG> lexerFileTimes;
+static std::vector<std::string> reloadedLexers;
+static std::map<uptr_t, size_t> bufferReloads;
+
+typedef ILexer *(*LexerFactoryFunction)();
+typedef LexerFactoryFunction (__stdcall *GetLexerFactoryFunction)(unsigned int);
 
 // Helper functions
 static std::string DetermineLanguageFromFileName(const std::string &fileName);
+static void CALLBACK IdleTimer(HWND hwnd, UINT msg, UINT_PTR idEvent, DWORD time);
+static void CheckForChangedLexers();
 
 // Menu callbacks
 static void editSettings();
@@ -47,6 +66,9 @@ static void showAbout();
 static void setLanguage();
 static void editLanguageDefinition();
 static void createNewLanguageDefinition();
+static void showStatistics();
+static void dumpStatistics();
+static void saveTrace();
 
 FuncItem funcItem[] = {
 	{ TEXT("Set Language..."), setLanguage, 0, false, nullptr },
@@ -55,29 +77,142 @@ FuncItem funcItem[] = {
 	{ TEXT("Edit Language Definition..."), editLanguageDefinition, 0, false, nullptr },
 	{ TEXT("Edit Settings..."), editSettings, 0, false, nullptr },
 	{ TEXT(""), nullptr, 0, false, nullptr }, // separator
+	{ TEXT("Show Lexer Statistics"), showStatistics, 0, false, nullptr },
+	{ TEXT("Dump Lexer Statistics"), dumpStatistics, 0, false, nullptr },
+	{ TEXT("Save Trace..."), saveTrace, 0, false, nullptr },
+	{ TEXT(""), nullptr, 0, false, nullptr }, // separator
 	{ TEXT("About..."), showAbout, 0, false, nullptr }
 };
 
 static std::string DetermineLanguageFromFileName(const std::string &fileName) {
-	for (const auto &kv : config.file_extensions) {
-		for (const auto &ext : kv.second) {
-			if (MatchWild(ext.c_str(), ext.size(), fileName.c_str(), true)) {
-				return kv.first;
-			}
+	return LanguageFromFileName(&config, fileName);
+}
+
+// Files whose names match no pattern are recognized by the start of their text. Only that
+// much is read, so Scintilla does not have to move its gap out of the rest of the document.
+static std::string DetermineLanguageFromContent() {
+	if (config.sniff <= 0)
+		return std::string("");
+
+	int length = editor.GetLength();
+	if (length > config.sniff) length = config.sniff;
+
+	return LanguageFromContent(&config, editor.GetRangePointer(0, length), length);
+}
+
+// The language of the current buffer is only detected again once its file name changes
+// or it is saved, since saving can change the start of its text
+static std::string DetermineBufferLanguage() {
+	auto fileName = npp.GetFileName();
+	auto &detected = bufferFileLanguages[npp.GetCurrentBufferID()];
+
+	if (detected.first.empty() || detected.first != fileName) {
+		auto language = DetermineLanguageFromFileName(UTF8FromString(fileName));
+		if (language.empty()) language = DetermineLanguageFromContent();
+
+		detected = { fileName, language };
+	}
+
+	return detected.second;
+}
+
+static void LoadConfig() {
+	LPegTraceScope scope(&trace, "ConfigLoad", "plugin");
+	ConfigLoad(npp, &config);
+	bufferFileLanguages.clear();
+
+	size_t traceSize = config.trace > 0 ? config.trace : 0;
+	if (trace.Size() != traceSize) {
+		trace.Resize(traceSize);
+	}
+}
+
+// The number of lines at the start of a document checked against the line lengths of the
+// large file tiers, so checking stays cheap however large the document is
+static const int largeFileSampleLines = 1000;
+
+// The number of bytes the viewport tier lexes at the end of what comes into view
+static const int largeFileViewport = 64 * 1024;
+
+// Returns the most reduced behavior whose tier the current document reaches
+static LargeFileBehavior GetLargeFileBehavior() {
+	long long length = editor.GetLength();
+	int lines = editor.GetLineCount();
+	int longestLine = 0;
+
+	for (int line = 0; line < lines && line < largeFileSampleLines; ++line) {
+		int lineLength = editor.LineLength(line);
+		if (lineLength > longestLine) longestLine = lineLength;
+	}
+
+	for (int i = LARGEFILE_BEHAVIORS - 1; i > LARGEFILE_FULL; --i) {
+		const auto &tier = config.large_files[i];
+		if ((tier.size > 0 && length >= tier.size) || (tier.line_length > 0 && longestLine >= tier.line_length))
+			return static_cast<LargeFileBehavior>(i);
+	}
+
+	return LARGEFILE_FULL;
+}
+
+// The properties every LPeg lexer is given before its language. Each large file tier also
+// reduces the lexing the way the tiers before it do.
+static std::vector<std::pair<std::string, std::string>> GetLexerProperties(LargeFileBehavior behavior = LARGEFILE_FULL) {
+	auto config_dir = npp.GetPluginsConfigDir();
+	config_dir += L"\\Scintillua++";
+
+	return {
+		{ "lexer.lpeg.home", UTF8FromString(config_dir) },
+		{ "lexer.lpeg.color.theme", config.theme },
+		{ "lexer.lpeg.profile", std::to_string(config.profile) },
+		{ "lexer.lpeg.profile.file", UTF8FromString(config_dir + L"\\profile.folded") },
+		{ "lexer.lpeg.background", std::to_string(config.background) },
+		{ "lexer.lpeg.slice", std::to_string(config.slice) },
+		{ "lexer.lpeg.trace", std::to_string(config.trace) },
+		{ "lexer.lpeg.lexer.cache", std::to_string(config.lexer_cache) },
+		{ "lexer.lpeg.by.line", behavior >= LARGEFILE_BYLINE ? "1" : "0" },
+		{ "lexer.lpeg.viewport", std::to_string(behavior >= LARGEFILE_VIEWPORT ? largeFileViewport : 0) },
+		{ "fold", behavior >= LARGEFILE_NOFOLD ? "0" : "1" },
+	};
+}
+
+// Lexers whose files changed are reloaded by every buffer's lexer, but only once the buffer
+// is shown, so keep track of how many of the reloaded lexers each buffer has seen
+static void ReloadChangedLexers(const ScintillaGateway &e, uptr_t bufferid) {
+	auto search = bufferReloads.find(bufferid);
+	if (search == bufferReloads.end()) {
+		// The buffer's lexer is new, so it loads the current files anyway
+		bufferReloads[bufferid] = reloadedLexers.size();
+		return;
+	}
+
+	bool relex = false;
+	for (size_t i = search->second; i < reloadedLexers.size(); ++i) {
+		if (e.PrivateLexerCall(LPEG_RELOAD, reinterpret_cast<sptr_t>(reloadedLexers[i].c_str()))) {
+			relex = true;
 		}
 	}
+	search->second = reloadedLexers.size();
 
-	return std::string("");
+	if (relex) {
+		e.Colourise(0, -1);
+	}
 }
 
 static void SetLexer(const std::string &language) {
 	if (language.empty())
 		return;
 
+	LPegTraceScope scope(&trace, "SetLexer", "plugin");
+
 	npp.SetCurrentLangType(L_TEXT);
 
-	auto config_dir = npp.GetPluginsConfigDir();
-	config_dir += L"\\Scintillua++";
+	auto behavior = GetLargeFileBehavior();
+	if (behavior == LARGEFILE_PLAINTEXT) {
+		std::wstring ws = StringFromUTF8(language);
+		ws += L" (too large to lex)";
+		npp.SetStatusBar(STATUSBAR_DOC_TYPE, ws);
+		return;
+	}
 
 	editor.SetLexerLanguage("lpeg");
 
@@ -86,14 +221,21 @@ static void SetLexer(const std::string &language) {
 		return;
 	}
 
-	editor.SetProperty("lexer.lpeg.home", UTF8FromString(config_dir));
-	editor.SetProperty("lexer.lpeg.color.theme", config.theme);
-	editor.SetProperty("fold", "1");
+	for (const auto &property : GetLexerProperties(behavior)) {
+		editor.SetProperty(property.first, property.second);
+	}
+
+	ReloadChangedLexers(editor, npp.GetCurrentBufferID());
 
 	editor.PrivateLexerCall(SCI_GETDIRECTFUNCTION, editor.GetDirectFunction());
 	editor.PrivateLexerCall(SCI_SETDOCPOINTER, editor.GetDirectPointer());
 	editor.PrivateLexerCall(SCI_SETLEXERLANGUAGE, reinterpret_cast<sptr_t>(language.c_str()));
 
+	// Time-sliced lex calls leave the rest of the document for Scintilla to style when idle,
+	// but the viewport tier only lexes what comes into view
+	if (behavior >= LARGEFILE_VIEWPORT) editor.SetIdleStyling(SC_IDLESTYLING_NONE);
+	else if (config.slice > 0 && config.background <= 0) editor.SetIdleStyling(SC_IDLESTYLING_AFTERVISIBLE);
+
 	// Always show the folding margin. Since N++ doesn't recognize the file it won't have the margin showing.
 	editor.SetMarginWidthN(2, 14);
 
@@ -107,12 +249,146 @@ static void SetLexer(const std::string &language) {
 		return;
 	}
 
+	static const wchar_t *tierNames[] = { L" (lpeg)", L" (lpeg, no folding)", L" (lpeg, by line)", L" (lpeg, viewport only)" };
+
 	std::wstring ws = StringFromUTF8(language);
-	ws += L" (lpeg)";
+	ws += tierNames[behavior];
 	npp.SetStatusBar(STATUSBAR_DOC_TYPE, ws);
 }
 
+// Returns the statistics of the LPeg lexer of the editor's document as "name=value" lines
+static std::string GetLexerStatistics(const ScintillaGateway &e) {
+	std::string text(e.PrivateLexerCall(LPEG_GETSTATISTICSTEXT, 0) + 1, '\0');
+	e.PrivateLexerCall(LPEG_GETSTATISTICSTEXT, reinterpret_cast<sptr_t>(&text[0]));
+	text.resize(strlen(text.c_str()));
+	return text;
+}
+
+// The lexers pause Lua's garbage collector while lexing. WM_TIMER messages are only
+// generated once the message queue is empty, so use a timer to collect the garbage
+// in small slices while Notepad++ is idle. The same timer applies the styles lexed
+// by background threads, which are only applied when the document is colourised.
+static void CALLBACK IdleTimer(HWND hwnd, UINT msg, UINT_PTR idEvent, DWORD time) {
+	ScintillaGateway editor1(nppData._scintillaMainHandle);
+	ScintillaGateway editor2(nppData._scintillaSecondHandle);
+
+	for (const auto &e : { &editor1, &editor2 }) {
+		if (e->GetLexerLanguage() == "lpeg") {
+			if (e->PrivateLexerCall(LPEG_BACKGROUND, 0)) {
+				e->Colourise(e->GetEndStyled(), -1);
+			}
+			e->PrivateLexerCall(LPEG_GCSTEP, 5);
+		}
+	}
+
+	CheckForChangedLexers();
+
+	// Keep the statistics of the current buffer so they can be dumped for every buffer
+	if (editor.GetLexerLanguage() == "lpeg") {
+		bufferStatistics[npp.GetCurrentBufferID()] = GetLexerStatistics(editor);
+	}
+}
+
+// Loads and compiles the lexers of the languages of all open files on a background thread,
+// so activating the files only has to attach them. Notepad++ restores the files of the last
+// session before NPPN_READY, and only the active one is given a lexer right away.
+static void PrewarmLexers(const std::wstring &lexerPath) {
+	LPegTraceScope scope(&trace, "PrewarmLexers", "plugin");
+
+	std::string languages;
+	for (const auto &path : npp.GetOpenFileNames()) {
+		auto fileName = path.substr(path.find_last_of(L"\\/") + 1);
+		auto language = DetermineLanguageFromFileName(UTF8FromString(fileName));
+		if (!language.empty() && (';' + languages + ';').find(';' + language + ';') == std::string::npos) {
+			if (!languages.empty()) languages += ';';
+			languages += language;
+		}
+	}
+
+	if (languages.empty())
+		return;
+
+	// Scintilla already loaded the library, this only adds a reference to it
+	lexerLibrary = LoadLibrary(lexerPath.c_str());
+	if (lexerLibrary == NULL)
+		return;
+
+	auto getLexerFactory = reinterpret_cast<GetLexerFactoryFunction>(GetProcAddress(lexerLibrary, "GetLexerFactory"));
+	if (getLexerFactory == nullptr || getLexerFactory(0) == nullptr)
+		return;
+
+	warmer = getLexerFactory(0)();
+	for (const auto &property : GetLexerProperties()) {
+		warmer->PropertySet(property.first.c_str(), property.second.c_str());
+	}
+	warmer->PrivateCall(LPEG_PREWARM, const_cast<char *>(languages.c_str()));
+}
+
+// Returns the last write times of the lexers in the lexer directory by language
+static std::map<std::string, ULONGLONG> GetLexerFileTimes(const std::wstring &lexerDir) {
+	std::map<std::string, ULONGLONG> times;
+
+	WIN32_FIND_DATA data;
+	HANDLE find = FindFirstFile((lexerDir + L"\\*.lua").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return times;
+
+	do {
+		std::wstring fileName(data.cFileName);
+		ULARGE_INTEGER time;
+		time.LowPart = data.ftLastWriteTime.dwLowDateTime;
+		time.HighPart = data.ftLastWriteTime.dwHighDateTime;
+		times[UTF8FromString(fileName.substr(0, fileName.size() - 4))] = time.QuadPart;
+	} while (FindNextFile(find, &data));
+	FindClose(find);
+
+	return times;
+}
+
+static void WatchLexerFiles() {
+	auto lexerDir = npp.GetPluginsConfigDir() + L"\\Scintillua++";
+	lexerFileTimes = GetLexerFileTimes(lexerDir);
+	lexerChanges = FindFirstChangeNotification(lexerDir.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+}
+
+// Reloads the lexers whose files changed in the lexers of the buffers shown in both views.
+// The lexer module and the theme are not reloaded.
+static void CheckForChangedLexers() {
+	if (lexerChanges == INVALID_HANDLE_VALUE || WaitForSingleObject(lexerChanges, 0) != WAIT_OBJECT_0)
+		return;
+
+	FindNextChangeNotification(lexerChanges);
+
+	auto times = GetLexerFileTimes(npp.GetPluginsConfigDir() + L"\\Scintillua++");
+	for (const auto &kv : times) {
+		const auto search = lexerFileTimes.find(kv.first);
+		if (kv.first == "lexer" || (search != lexerFileTimes.end() && search->second == kv.second))
+			continue;
+
+		LPegTraceScope scope(&trace, "ReloadLexer", "plugin");
+		reloadedLexers.push_back(kv.first);
+		if (warmer != nullptr) {
+			warmer->PrivateCall(LPEG_RELOAD, const_cast<char *>(kv.first.c_str()));
+		}
+	}
+	lexerFileTimes = times;
+
+	ScintillaGateway editor1(nppData._scintillaMainHandle);
+	ScintillaGateway editor2(nppData._scintillaSecondHandle);
+	int view = MAIN_VIEW;
+
+	for (const auto &e : { &editor1, &editor2 }) {
+		int index = npp.GetCurrentDocIndex(view);
+		if (index != -1 && e->GetLexerLanguage() == "lpeg") {
+			ReloadChangedLexers(*e, npp.GetBufferIDFromPos(index, view));
+		}
+		view = SUB_VIEW;
+	}
+}
+
 static void CheckFileForNewLexer() {
+	LPegTraceScope scope(&trace, "CheckFileForNewLexer", "plugin");
+
 	auto bufferid = npp.GetCurrentBufferID();
 	const auto search = bufferLanguages.find(bufferid);
 
@@ -120,8 +396,7 @@ static void CheckFileForNewLexer() {
 		SetLexer(search->second);
 	}
 	else if (config.over_ride || editor.GetLexer() == 1 /*SCLEX_NULL*/) {
-		auto ext = npp.GetFileName();
-		SetLexer(DetermineLanguageFromFileName(UTF8FromString(ext)));
+		SetLexer(DetermineBufferLanguage());
 	}
 }
 
@@ -191,7 +466,7 @@ extern "C" __declspec(dllexport) void beNotified(const SCNotification *notify) {
 #endif
 		case NPPN_READY: {
 			isReady = true;
-			ConfigLoad(npp, &config);
+			LoadConfig();
 
 			// Get the path to the external lexer
 			auto config_dir = npp.GetPluginsConfigDir();
@@ -208,6 +483,11 @@ extern "C" __declspec(dllexport) void beNotified(const SCNotification *notify) {
 			editor1.LoadLexerLibrary(wconfig_dir);
 			editor2.LoadLexerLibrary(wconfig_dir);
 
+			PrewarmLexers(config_dir);
+			WatchLexerFiles();
+
+			idleTimer = SetTimer(NULL, 0, 250, IdleTimer);
+
 			// Fall through - when launching N++, NPPN_BUFFERACTIVATED is received before
 			// NPPN_READY. Thus the first file can get ignored so now we can check now...
 		}
@@ -232,6 +512,7 @@ extern "C" __declspec(dllexport) void beNotified(const SCNotification *notify) {
 		}
 		case NPPN_FILESAVED: {
 			std::wstring fileSaved = npp.GetFullPathFromBufferID(notify->nmhdr.idFrom);
+			bufferFileLanguages.erase(notify->nmhdr.idFrom);
 
 			if (fileSaved != fileBeingSaved) {
 				// The file was saved as a different file name
@@ -239,13 +520,12 @@ extern "C" __declspec(dllexport) void beNotified(const SCNotification *notify) {
 			}
 			else if (fileSaved.compare(GetIniFilePath(npp)) == 0) {
 				// If the ini file was edited, reload it
-				ConfigLoad(npp, &config);
+				LoadConfig();
 			}
 			else
 			{
 				if (config.over_ride || editor.GetLexer() == 1 /*SCLEX_NULL*/) {
-					auto ext = npp.GetFileName();
-					SetLexer(DetermineLanguageFromFileName(UTF8FromString(ext)));
+					SetLexer(DetermineBufferLanguage());
 				}
 			}
 
@@ -253,10 +533,32 @@ extern "C" __declspec(dllexport) void beNotified(const SCNotification *notify) {
 
 			break;
 		}
+		case NPPN_SHUTDOWN:
+			if (idleTimer != 0) {
+				KillTimer(NULL, idleTimer);
+				idleTimer = 0;
+			}
+			if (warmer != nullptr) {
+				// Stops the warm-up and releases the lexers no file took over
+				warmer->Release();
+				warmer = nullptr;
+			}
+			if (lexerLibrary != NULL) {
+				FreeLibrary(lexerLibrary);
+				lexerLibrary = NULL;
+			}
+			if (lexerChanges != INVALID_HANDLE_VALUE) {
+				FindCloseChangeNotification(lexerChanges);
+				lexerChanges = INVALID_HANDLE_VALUE;
+			}
+			break;
 		case NPPN_LANGCHANGED:
 		case NPPN_FILECLOSED:
 			// Try to remove it
 			bufferLanguages.erase(notify->nmhdr.idFrom);
+			bufferStatistics.erase(notify->nmhdr.idFrom);
+			bufferReloads.erase(notify->nmhdr.idFrom);
+			bufferFileLanguages.erase(notify->nmhdr.idFrom);
 			break;
 	}
 	return;
@@ -325,3 +627,76 @@ static void createNewLanguageDefinition() {
 		npp.SetCurrentLangType(L_LUA);
 	}
 }
+
+static void showStatistics() {
+	if (editor.GetLexerLanguage() != "lpeg") {
+		MessageBox(nppData._nppHandle, L"The current file is not using an LPeg lexer.", NPP_PLUGIN_NAME, MB_OK | MB_ICONINFORMATION);
+		return;
+	}
+
+	std::string text = GetLexerStatistics(editor);
+	bufferStatistics[npp.GetCurrentBufferID()] = text;
+
+	MessageBox(nppData._nppHandle, StringFromUTF8(text).c_str(), NPP_PLUGIN_NAME, MB_OK | MB_ICONINFORMATION);
+}
+
+static void dumpStatistics() {
+	if (editor.GetLexerLanguage() == "lpeg") {
+		bufferStatistics[npp.GetCurrentBufferID()] = GetLexerStatistics(editor);
+	}
+
+	// Buffers that are not current have the statistics they had when they last were
+	std::string text;
+	for (const auto &kv : bufferStatistics) {
+		text += "; " + UTF8FromString(npp.GetFullPathFromBufferID(kv.first)) + "\r\n";
+
+		for (const auto &line : split(kv.second, '\n')) {
+			if (!line.empty()) text += line + "\r\n";
+		}
+		text += "\r\n";
+	}
+
+	npp.MenuCommand(IDM_FILE_NEW);
+	editor.SetText(text);
+}
+
+static void saveTrace() {
+	if (!trace.Enabled()) {
+		MessageBox(nppData._nppHandle, L"Tracing is off. Set \"trace\" in the settings to the number of events to keep.", NPP_PLUGIN_NAME, MB_OK | MB_ICONINFORMATION);
+		return;
+	}
+
+	std::string events = trace.Json();
+
+	// All the LPeg lexers share one trace, so any of them can return it
+	ScintillaGateway editor1(nppData._scintillaMainHandle);
+	ScintillaGateway editor2(nppData._scintillaSecondHandle);
+
+	for (const auto &e : { &editor1, &editor2 }) {
+		if (e->GetLexerLanguage() == "lpeg") {
+			std::string lexerEvents(e->PrivateLexerCall(LPEG_GETTRACE, 0) + 1, '\0');
+			e->PrivateLexerCall(LPEG_GETTRACE, reinterpret_cast<sptr_t>(&lexerEvents[0]));
+			lexerEvents.resize(strlen(lexerEvents.c_str()));
+
+			if (!lexerEvents.empty()) {
+				if (!events.empty()) events += ',';
+				events += lexerEvents;
+			}
+			break;
+		}
+	}
+
+	auto path = npp.GetPluginsConfigDir();
+	path += L"\\Scintillua++\\trace.json";
+
+	FILE *file = _wfopen(path.c_str(), L"wb");
+	if (file == nullptr) {
+		MessageBox(nppData._nppHandle, (L"Failed to write " + path).c_str(), NPP_PLUGIN_NAME, MB_OK | MB_ICONERROR);
+		return;
+	}
+
+	fprintf(file, "{\"traceEvents\":[\n%s]}\n", events.c_str());
+	fclose(file);
+
+	MessageBox(nppData._nppHandle, (L"Trace saved to " + path).c_str(), NPP_PLUGIN_NAME, MB_OK | MB_ICONINFORMATION);
+}
@@ -21,6 +21,7 @@
 #include "PluginInterface.h"
 
 #include <string>
+#include <vector>
 
 typedef uptr_t BufferID;
 
@@ -67,8 +68,21 @@ public:
 		Call(NPPM_SETCURRENTLANGTYPE, 0, lang);
 	}
 	
-	//NPPM_GETNBOPENFILES
-	//NPPM_GETOPENFILENAMES
+	int GetNbOpenFiles(int view = ALL_OPEN_FILES) const {
+		return static_cast<int>(Call(NPPM_GETNBOPENFILES, 0, view));
+	}
+
+	std::vector<std::wstring> GetOpenFileNames() const {
+		std::vector<std::wstring> names(GetNbOpenFiles(), std::wstring(MAX_PATH, '\0'));
+		std::vector<wchar_t *> buffers;
+		for (auto &name : names) buffers.push_back(&name[0]);
+
+		auto count = Call(NPPM_GETOPENFILENAMES, buffers.data(), buffers.size());
+		names.resize(static_cast<size_t>(count));
+		for (auto &name : names) trim(name);
+		return names;
+	}
+
 	//NPPM_MODELESSDIALOG
 	//NPPM_GETNBSESSIONFILES
 	//NPPM_GETSESSIONFILES
@@ -79,7 +93,10 @@ public:
 	//NPPM_CREATESCINTILLAHANDLE
 	//NPPM_DESTROYSCINTILLAHANDLE
 	//NPPM_GETNBUSERLANG
-	//NPPM_GETCURRENTDOCINDEX
+
+	int GetCurrentDocIndex(int view) const {
+		return static_cast<int>(Call(NPPM_GETCURRENTDOCINDEX, 0, view));
+	}
 
 	void SetStatusBar(int section, const wchar_t *status) const {
 		Call(NPPM_SETSTATUSBAR, section, status);
@@ -156,7 +173,9 @@ public:
 		return text;
 	}
 
-	//NPPM_GETBUFFERIDFROMPOS
+	BufferID GetBufferIDFromPos(int position, int view) const {
+		return Call(NPPM_GETBUFFERIDFROMPOS, position, view);
+	}
 
 	BufferID GetCurrentBufferID() const {
 		return Call(NPPM_GETCURRENTBUFFERID, 0, 0);
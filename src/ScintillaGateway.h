@@ -1514,6 +1514,15 @@ public:
 		return static_cast<int>(res);
 	}
 
+	void SetIdleStyling(int idleStyling) const {
+		Call(SCI_SETIDLESTYLING, idleStyling, SCI_UNUSED);
+	}
+
+	int GetIdleStyling() const {
+		sptr_t res = Call(SCI_GETIDLESTYLING, SCI_UNUSED, SCI_UNUSED);
+		return static_cast<int>(res);
+	}
+
 	void SetWrapMode(int mode) const {
 		Call(SCI_SETWRAPMODE, mode, SCI_UNUSED);
 	}
@@ -0,0 +1,675 @@
+// This file is part of Scintillua++.
+//
+// Copyright (C)2017 Justin Dailey <dail8859@yahoo.com>
+//
+// Scintillua++ is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// Highlights files with the same LPeg lexers and themes the plugin uses, without an editor,
+// and writes them out as HTML or as text with ANSI colors.
+//
+// Usage: BatchHighlight -d <lexers directory> [options] <files...>
+//
+//   -t <theme>     the theme to style with ("light" by default)
+//   -c <ini>       the settings file to take the languages' file name patterns and content
+//                  signatures from
+//   -l <language>  the language of every file, instead of detecting it like the plugin does
+//   -f html|ansi   the output format (ansi by default)
+//   -o <directory> write each file's output to <directory>/<file>.html or .ansi instead
+//                  of writing all of them to the standard output in order. The file's path
+//                  is kept without its root, and ".." components never leave <directory>.
+//   -j <workers>   the number of worker threads (the number of processors by default)
+//
+// Each worker keeps one lexer, and so one Lua state, for all the files it highlights, so
+// lexers are only loaded once per worker. Files are mapped into memory and lexed in place.
+// The throughput is reported on the standard error once all files are done.
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if _WIN32
+#include <direct.h>
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ILexer.h"
+#include "Scintilla.h"
+#include "LexerModule.h"
+#include "LexLPeg.h"
+#include "ConfigParser.h"
+
+#if _WIN32
+#define EXT_LEXER_DECL __declspec( dllexport ) __stdcall
+#else
+#define EXT_LEXER_DECL
+#endif
+extern "C" LexerFactoryFunction EXT_LEXER_DECL GetLexerFactory(unsigned int index);
+
+// The characters that separate the components of a path
+#if _WIN32
+static const char pathSeparators[] = "/\\";
+#else
+static const char pathSeparators[] = "/";
+#endif
+
+struct Options {
+	std::string lexers;
+	std::string theme = "light";
+	std::string language;
+	std::string output;
+	bool html = false;
+	unsigned int workers = 0;
+	// The languages' file name patterns and content signatures, read like the plugin does
+	Configuration config = Configuration();
+};
+
+// A document held in memory for the lexer to style, with no undo, views, or markers
+class MemoryDocument : public IDocument {
+	const char *text;
+	Sci_Position length;
+	std::vector<Sci_Position> lineStarts;
+	std::vector<int> levels;
+	std::vector<int> lineStates;
+	Sci_Position stylingPosition;
+
+public:
+	std::vector<char> styles;
+
+	MemoryDocument(const char *text, Sci_Position length) : text(text), length(length), stylingPosition(0), styles(length, 0) {
+		lineStarts.push_back(0);
+		for (const char *p = text, *end = text + length; (p = static_cast<const char *>(memchr(p, '\n', end - p))) != nullptr; ++p)
+			lineStarts.push_back(p - text + 1);
+		levels.assign(lineStarts.size(), SC_FOLDLEVELBASE);
+		lineStates.assign(lineStarts.size(), 0);
+	}
+
+	int SCI_METHOD Version() const { return dvOriginal; }
+	void SCI_METHOD SetErrorStatus(int) {}
+	Sci_Position SCI_METHOD Length() const { return length; }
+	void SCI_METHOD GetCharRange(char *buffer, Sci_Position position, Sci_Position lengthRetrieve) const {
+		memcpy(buffer, text + position, lengthRetrieve);
+	}
+	char SCI_METHOD StyleAt(Sci_Position position) const {
+		return position >= 0 && position < length ? styles[position] : 0;
+	}
+	Sci_Position SCI_METHOD LineFromPosition(Sci_Position position) const {
+		return std::upper_bound(lineStarts.begin(), lineStarts.end(), position) - lineStarts.begin() - 1;
+	}
+	Sci_Position SCI_METHOD LineStart(Sci_Position line) const {
+		if (line < 0) return 0;
+		return line < static_cast<Sci_Position>(lineStarts.size()) ? lineStarts[line] : length;
+	}
+	int SCI_METHOD GetLevel(Sci_Position line) const {
+		return line >= 0 && line < static_cast<Sci_Position>(levels.size()) ? levels[line] : SC_FOLDLEVELBASE;
+	}
+	int SCI_METHOD SetLevel(Sci_Position line, int level) {
+		if (line >= 0 && line < static_cast<Sci_Position>(levels.size())) levels[line] = level;
+		return 0;
+	}
+	int SCI_METHOD GetLineState(Sci_Position line) const {
+		return line >= 0 && line < static_cast<Sci_Position>(lineStates.size()) ? lineStates[line] : 0;
+	}
+	int SCI_METHOD SetLineState(Sci_Position line, int state) {
+		if (line >= 0 && line < static_cast<Sci_Position>(lineStates.size())) lineStates[line] = state;
+		return 0;
+	}
+	void SCI_METHOD StartStyling(Sci_Position position, char) { stylingPosition = position; }
+	bool SCI_METHOD SetStyleFor(Sci_Position lengthStyle, char style) {
+		lengthStyle = std::min(lengthStyle, length - stylingPosition);
+		memset(&styles[0] + stylingPosition, style, lengthStyle);
+		stylingPosition += lengthStyle;
+		return true;
+	}
+	bool SCI_METHOD SetStyles(Sci_Position lengthStyles, const char *newStyles) {
+		lengthStyles = std::min(lengthStyles, length - stylingPosition);
+		memcpy(&styles[0] + stylingPosition, newStyles, lengthStyles);
+		stylingPosition += lengthStyles;
+		return true;
+	}
+	void SCI_METHOD DecorationSetCurrentIndicator(int) {}
+	void SCI_METHOD DecorationFillRange(Sci_Position, int, Sci_Position) {}
+	void SCI_METHOD ChangeLexerState(Sci_Position, Sci_Position) {}
+	int SCI_METHOD CodePage() const { return SC_CP_UTF8; }
+	bool SCI_METHOD IsDBCSLeadByte(char) const { return false; }
+	const char * SCI_METHOD BufferPointer() { return text; }
+	int SCI_METHOD GetLineIndentation(Sci_Position line) {
+		int indentation = 0;
+		for (Sci_Position i = LineStart(line); i < length && (text[i] == ' ' || text[i] == '\t'); ++i)
+			indentation = text[i] == ' ' ? indentation + 1 : (indentation / 8 + 1) * 8;
+		return indentation;
+	}
+};
+
+// The look of a style, from a style string like "fore:#RRGGBB,bold"
+struct StyleLook {
+	std::string name;
+	int fore = -1;
+	int back = -1;
+	bool bold = false;
+	bool italics = false;
+	bool underlined = false;
+};
+
+// Applies the attributes of a style string on top of the ones the look already has, the
+// way Scintilla applies a style's attributes on top of the default style's
+static void ParseStyle(const std::string &style, StyleLook *look) {
+	size_t start = 0;
+	while (start <= style.size()) {
+		size_t end = style.find(',', start);
+		if (end == std::string::npos) end = style.size();
+		std::string option = style.substr(start, end - start);
+		std::string value;
+		size_t colon = option.find(':');
+		if (colon != std::string::npos) {
+			value = option.substr(colon + 1);
+			option.erase(colon);
+		}
+		start = end + 1;
+
+		if (option == "bold" || option == "notbold") look->bold = option[0] == 'b';
+		else if (option == "weight") look->bold = atoi(value.c_str()) > SC_WEIGHT_NORMAL;
+		else if (option == "italics" || option == "notitalics") look->italics = option[0] == 'i';
+		else if (option == "underlined" || option == "notunderlined") look->underlined = option[0] == 'u';
+		else if ((option == "fore" || option == "back") && !value.empty()) {
+			// Colors are #RRGGBB or Scintilla's 0xBBGGRR, kept here as 0xRRGGBB
+			long color = strtol(value.c_str() + (value[0] == '#'), nullptr, value[0] == '#' ? 16 : 0);
+			if (value[0] != '#')
+				color = ((color & 0xFF) << 16) | (color & 0xFF00) | ((color >> 16) & 0xFF);
+			(option[0] == 'f' ? look->fore : look->back) = static_cast<int>(color);
+		}
+	}
+}
+
+// Returns the looks of the lexer's styles by style number
+static std::vector<StyleLook> GetStyleLooks(ILexer *lexer) {
+	char buffer[1024];
+
+	buffer[0] = '\0';
+	lexer->PrivateCall(STYLE_DEFAULT - STYLE_MAX, buffer);
+	StyleLook base;
+	ParseStyle(buffer, &base);
+
+	std::vector<StyleLook> looks(STYLE_MAX + 1, base);
+	for (int style = 0; style < STYLE_MAX; ++style) {
+		buffer[0] = '\0';
+		lexer->PrivateCall(style, buffer);
+		looks[style].name = buffer;
+
+		buffer[0] = '\0';
+		lexer->PrivateCall(style - STYLE_MAX, buffer);
+		ParseStyle(buffer, &looks[style]);
+	}
+
+	return looks;
+}
+
+static std::string ColorText(int color, const char *format) {
+	char text[32];
+	snprintf(text, sizeof(text), format, (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF);
+	return text;
+}
+
+static bool SameLook(const StyleLook &a, const StyleLook &b) {
+	return a.fore == b.fore && a.back == b.back && a.bold == b.bold && a.italics == b.italics && a.underlined == b.underlined;
+}
+
+// Returns the class a style's spans get, made of the characters CSS allows in one
+static std::string ClassName(const StyleLook &look) {
+	std::string name(look.name);
+	for (auto &ch : name)
+		if (!isalnum(static_cast<unsigned char>(ch)) && ch != '_' && ch != '-') ch = '-';
+	return name;
+}
+
+static std::string HtmlDocument(const std::string &title, const char *text, const std::vector<char> &styles, const std::vector<StyleLook> &looks) {
+	std::vector<bool> used(looks.size(), false);
+	for (char style : styles) used[static_cast<unsigned char>(style)] = true;
+
+	std::string html("<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n<title>");
+	for (char ch : title) html += ch == '<' ? "&lt;" : ch == '&' ? "&amp;" : std::string(1, ch);
+	html += "</title>\n<style>\npre {";
+	const StyleLook &base = looks[STYLE_DEFAULT];
+	if (base.fore >= 0) html += " color: " + ColorText(base.fore, "#%02X%02X%02X") + ";";
+	if (base.back >= 0) html += " background: " + ColorText(base.back, "#%02X%02X%02X") + ";";
+	html += " }\n";
+	for (size_t style = 0; style < looks.size(); ++style) {
+		const StyleLook &look = looks[style];
+		if (!used[style] || look.name.empty() || SameLook(look, base)) continue;
+		html += "." + ClassName(look) + " {";
+		if (look.fore >= 0) html += " color: " + ColorText(look.fore, "#%02X%02X%02X") + ";";
+		if (look.back >= 0 && look.back != base.back) html += " background: " + ColorText(look.back, "#%02X%02X%02X") + ";";
+		if (look.bold) html += " font-weight: bold;";
+		if (look.italics) html += " font-style: italic;";
+		if (look.underlined) html += " text-decoration: underline;";
+		html += " }\n";
+	}
+	html += "</style>\n</head>\n<body>\n<pre>";
+
+	size_t length = styles.size();
+	for (size_t start = 0, end = 0; start < length; start = end) {
+		int style = static_cast<unsigned char>(styles[start]);
+		for (end = start; end < length && styles[end] == styles[start]; ++end) {}
+
+		bool span = !looks[style].name.empty() && !SameLook(looks[style], base);
+		if (span) html += "<span class=\"" + ClassName(looks[style]) + "\">";
+		for (size_t i = start; i < end; ++i) {
+			switch (text[i]) {
+				case '<': html += "&lt;"; break;
+				case '>': html += "&gt;"; break;
+				case '&': html += "&amp;"; break;
+				case '\r': break;
+				default: html += text[i];
+			}
+		}
+		if (span) html += "</span>";
+	}
+
+	html += "</pre>\n</body>\n</html>\n";
+	return html;
+}
+
+// Returns the text with 24-bit ANSI colors. The default style's background is left to the
+// terminal, and every line starts from the terminal's own colors.
+static std::string AnsiText(const char *text, const std::vector<char> &styles, const std::vector<StyleLook> &looks) {
+	std::vector<std::string> escapes(looks.size());
+	const StyleLook &base = looks[STYLE_DEFAULT];
+	for (size_t style = 0; style < looks.size(); ++style) {
+		const StyleLook &look = looks[style];
+		std::string &escape = escapes[style];
+		if (look.fore >= 0) escape += ColorText(look.fore, "\x1b[38;2;%d;%d;%dm");
+		if (look.back >= 0 && look.back != base.back) escape += ColorText(look.back, "\x1b[48;2;%d;%d;%dm");
+		if (look.bold) escape += "\x1b[1m";
+		if (look.italics) escape += "\x1b[3m";
+		if (look.underlined) escape += "\x1b[4m";
+	}
+
+	std::string ansi;
+	int current = -1;
+	for (size_t i = 0; i < styles.size(); ++i) {
+		if (text[i] == '\n') {
+			if (current >= 0 && !escapes[current].empty()) ansi += "\x1b[0m";
+			ansi += '\n';
+			current = -1;
+			continue;
+		}
+		int style = static_cast<unsigned char>(styles[i]);
+		if (style != current) {
+			if (current >= 0 && !escapes[current].empty()) ansi += "\x1b[0m";
+			ansi += escapes[style];
+			current = style;
+		}
+		ansi += text[i];
+	}
+	if (current >= 0 && !escapes[current].empty()) ansi += "\x1b[0m";
+
+	return ansi;
+}
+
+// Returns the language the plugin would give the file: the one of the first pattern its name
+// matches, or else the one the start of its text looks like
+static std::string DetectLanguage(const Options &options, const std::string &path, const char *text, size_t size) {
+	if (!options.language.empty())
+		return options.language;
+
+	std::string language = LanguageFromFileName(&options.config, path.substr(path.find_last_of(pathSeparators) + 1));
+	if (language.empty() && options.config.sniff > 0)
+		language = LanguageFromContent(&options.config, text, std::min(size, static_cast<size_t>(options.config.sniff)));
+
+	return language;
+}
+
+// Reads the settings file
+static bool LoadConfig(const std::string &ini, Options *options) {
+	FILE *file = fopen(ini.c_str(), "r");
+	if (file == nullptr)
+		return false;
+
+	ConfigParse(file, &options->config);
+	fclose(file);
+
+	return true;
+}
+
+// Returns the description of the last error of the C library or the system
+static std::string LastError() {
+#if _WIN32
+	char text[256] = { 0 };
+	FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr, GetLastError(), 0, text, sizeof(text), nullptr);
+	std::string error(text);
+	while (!error.empty() && isspace(static_cast<unsigned char>(error.back()))) error.pop_back();
+	return error;
+#else
+	return strerror(errno);
+#endif
+}
+
+// A file mapped into memory for reading, so it is lexed in place
+class MappedFile {
+#if _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+	void *view;
+
+public:
+	const char *text;
+	size_t size;
+	std::string error;
+
+	explicit MappedFile(const std::string &path) : view(nullptr), text(""), size(0) {
+#if _WIN32
+		mapping = nullptr;
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER length;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &length)) {
+			error = LastError();
+			return;
+		}
+		size = static_cast<size_t>(length.QuadPart);
+		if (size == 0) return;
+		if ((mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr)) == nullptr ||
+			(view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) == nullptr) {
+			error = LastError();
+			return;
+		}
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0) {
+			error = LastError();
+			if (fd >= 0) close(fd);
+			return;
+		}
+		size = static_cast<size_t>(st.st_size);
+		if (size > 0) {
+			view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (view == MAP_FAILED) {
+				error = LastError();
+				view = nullptr;
+			}
+			else {
+				madvise(view, size, MADV_SEQUENTIAL);
+			}
+		}
+		close(fd);
+		if (view == nullptr) return;
+#endif
+		text = static_cast<const char *>(view);
+	}
+
+	~MappedFile() {
+#if _WIN32
+		if (view != nullptr) UnmapViewOfFile(view);
+		if (mapping != nullptr) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+		if (view != nullptr) munmap(view, size);
+#endif
+	}
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+};
+
+// Returns where the output of the file goes: the file's path under the output directory,
+// without its root or "." components, and with ".." components resolved. A ".." that would
+// leave the directory the path starts from is dropped, so no output is written outside the
+// output directory.
+static std::string OutputPath(const Options &options, const std::string &path) {
+	std::vector<std::string> components;
+	for (size_t start = 0; start <= path.size();) {
+		size_t end = path.find_first_of(pathSeparators, start);
+		if (end == std::string::npos) end = path.size();
+
+		std::string component = path.substr(start, end - start);
+#if _WIN32
+		bool drive = start == 0 && component.size() == 2 && component[1] == ':';
+#else
+		bool drive = false;
+#endif
+		if (component == "..") {
+			if (!components.empty()) components.pop_back();
+		}
+		else if (!component.empty() && component != "." && !drive) {
+			components.push_back(component);
+		}
+
+		start = end + 1;
+	}
+
+	std::string output = options.output;
+	for (const auto &component : components)
+		output += "/" + component;
+
+	return output + (options.html ? ".html" : ".ansi");
+}
+
+// Creates the directories leading to the file
+static void MakeParentDirectories(const std::string &path) {
+	for (size_t slash = path.find_first_of(pathSeparators, 1); slash != std::string::npos; slash = path.find_first_of(pathSeparators, slash + 1)) {
+#if _WIN32
+		_mkdir(path.substr(0, slash).c_str());
+#else
+		mkdir(path.substr(0, slash).c_str(), 0777);
+#endif
+	}
+}
+
+// Writes the output to the file, creating the directories leading to it. Sets the error if
+// the file could not be written.
+static bool WriteOutput(const std::string &path, const std::string &output, std::string *error) {
+	MakeParentDirectories(path);
+
+	FILE *file = fopen(path.c_str(), "wb");
+	bool ok = file != nullptr && fwrite(output.data(), 1, output.size(), file) == output.size();
+	if (!ok) *error = path + ": " + LastError();
+	if (file != nullptr && fclose(file) != 0 && ok) {
+		*error = path + ": " + LastError();
+		ok = false;
+	}
+
+	return ok;
+}
+
+struct Totals {
+	std::atomic<size_t> files{ 0 };
+	std::atomic<size_t> skipped{ 0 };
+	std::atomic<size_t> failed{ 0 };
+	std::atomic<unsigned long long> bytes{ 0 };
+};
+
+// Writes the outputs to the standard output in the order of the files, as they are done
+class OrderedOutput {
+	std::mutex lock;
+	std::vector<std::string> outputs;
+	std::vector<bool> done;
+	size_t written;
+
+public:
+	explicit OrderedOutput(size_t files) : outputs(files), done(files, false), written(0) {}
+
+	void Add(size_t index, std::string output) {
+		std::lock_guard<std::mutex> guard(lock);
+		outputs[index] = std::move(output);
+		done[index] = true;
+		for (; written < done.size() && done[written]; ++written) {
+			fwrite(outputs[written].data(), 1, outputs[written].size(), stdout);
+			std::string().swap(outputs[written]);
+		}
+	}
+};
+
+// Highlights the file with the worker's lexer. Returns the output, or sets the error. Files
+// with no language are not highlighted and leave the error empty.
+static bool HighlightFile(const Options &options, ILexer *lexer, std::map<std::string, std::vector<StyleLook>> &looks,
+	const std::string &path, std::string *output, std::string *error, size_t *size) {
+	MappedFile file(path);
+	if (!file.error.empty()) {
+		*error = file.error;
+		return false;
+	}
+
+	const char *text = file.text;
+	*size = file.size;
+
+	std::string language = DetectLanguage(options, path, text, *size);
+	char status[512] = { 0 };
+	if (!language.empty()) {
+		lexer->PrivateCall(SCI_SETLEXERLANGUAGE, const_cast<char *>(language.c_str()));
+		lexer->PrivateCall(SCI_GETSTATUS, status);
+	}
+
+	bool ok = !language.empty() && strlen(status) == 0;
+	if (ok) {
+		auto search = looks.find(language);
+		if (search == looks.end())
+			search = looks.emplace(language, GetStyleLooks(lexer)).first;
+
+		MemoryDocument document(text, *size);
+		if (*size > 0) lexer->Lex(0, *size, STYLE_DEFAULT, &document);
+
+		*output = options.html ? HtmlDocument(path, text, document.styles, search->second) : AnsiText(text, document.styles, search->second);
+	}
+	else {
+		*error = status;
+	}
+
+	return ok;
+}
+
+static void Worker(const Options &options, const std::vector<std::string> &files, std::atomic<size_t> &next,
+	OrderedOutput &ordered, Totals &totals) {
+	ILexer *lexer = GetLexerFactory(0)();
+	lexer->PropertySet("lexer.lpeg.home", options.lexers.c_str());
+	if (!options.theme.empty()) lexer->PropertySet("lexer.lpeg.color.theme", options.theme.c_str());
+	// Lex every file at once on this thread, without folding
+	lexer->PropertySet("lexer.lpeg.background", "0");
+	lexer->PropertySet("lexer.lpeg.slice", "0");
+	lexer->PropertySet("fold", "0");
+	// Keep every lexer loaded, so a language's style numbers stay the same
+	lexer->PropertySet("lexer.lpeg.lexer.cache", "0");
+
+	std::map<std::string, std::vector<StyleLook>> looks;
+	for (size_t index; (index = next++) < files.size();) {
+		const std::string &path = files[index];
+		std::string output, error;
+		size_t size = 0;
+
+		if (!HighlightFile(options, lexer, looks, path, &output, &error, &size)) {
+			if (error.empty()) {
+				fprintf(stderr, "%s: no language matches the file\n", path.c_str());
+				totals.skipped++;
+			}
+			else {
+				fprintf(stderr, "%s: %s\n", path.c_str(), error.c_str());
+				totals.failed++;
+			}
+		}
+		else if (!options.output.empty() && !WriteOutput(OutputPath(options, path), output, &error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			totals.failed++;
+		}
+		else {
+			totals.files++;
+			totals.bytes += size;
+		}
+
+		if (options.output.empty())
+			ordered.Add(index, std::move(output));
+	}
+
+	lexer->Release();
+}
+
+static int Usage(const char *program) {
+	fprintf(stderr, "usage: %s -d <lexers directory> [-t theme] [-c ini] [-l language] [-f html|ansi] "
+		"[-o directory] [-j workers] <files...>\n", program);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	std::vector<std::string> files;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg(argv[i]);
+		if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc) {
+			std::string value(argv[++i]);
+			switch (arg[1]) {
+				case 'd': options.lexers = value; break;
+				case 't': options.theme = value; break;
+				case 'l': options.language = value; break;
+				case 'o': options.output = value; break;
+				case 'j': options.workers = static_cast<unsigned int>(atoi(value.c_str())); break;
+				case 'f':
+					if (value != "html" && value != "ansi") return Usage(argv[0]);
+					options.html = value == "html";
+					break;
+				case 'c':
+					if (!LoadConfig(value, &options)) {
+						fprintf(stderr, "%s: %s\n", value.c_str(), strerror(errno));
+						return 1;
+					}
+					break;
+				default: return Usage(argv[0]);
+			}
+		}
+		else {
+			files.push_back(arg);
+		}
+	}
+
+	if (options.lexers.empty() || files.empty())
+		return Usage(argv[0]);
+
+	if (options.workers == 0) options.workers = std::max(1u, std::thread::hardware_concurrency());
+	if (options.workers > files.size()) options.workers = static_cast<unsigned int>(files.size());
+
+	Totals totals;
+	OrderedOutput ordered(files.size());
+	std::atomic<size_t> next(0);
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < options.workers; ++i)
+		workers.emplace_back(Worker, std::cref(options), std::cref(files), std::ref(next), std::ref(ordered), std::ref(totals));
+	for (auto &worker : workers)
+		worker.join();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double megabytes = totals.bytes / (1024.0 * 1024.0);
+	fprintf(stderr, "%zu files (%zu skipped, %zu failed), %.2f MB in %.3f s with %u workers: %.2f MB/s, %.1f files/s\n",
+		totals.files.load(), totals.skipped.load(), totals.failed.load(), megabytes, seconds, options.workers,
+		megabytes / std::max(seconds, 1e-9), totals.files / std::max(seconds, 1e-9));
+
+	return totals.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+// This file is part of Scintillua++.
+//
+// Copyright (C)2017 Justin Dailey <dail8859@yahoo.com>
+//
+// Scintillua++ is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// Loads every lexer in a lexer directory with a fresh LPeg lexer, the way a
+// newly opened document would, and ranks them by what that costs.
+//
+// Usage: LexerReport <lexers directory> [runs] [theme]
+//
+// Each lexer is loaded `runs` times (5 by default) and the fastest load is
+// reported, which keeps disk caches and the scheduler out of the numbers.
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include "ILexer.h"
+#include "Scintilla.h"
+#include "LexerModule.h"
+#include "LexLPeg.h"
+
+#if _WIN32
+#define EXT_LEXER_DECL __declspec( dllexport ) __stdcall
+#else
+#define EXT_LEXER_DECL
+#endif
+extern "C" LexerFactoryFunction EXT_LEXER_DECL GetLexerFactory(unsigned int index);
+
+struct LexerCost {
+	std::string name;
+	double total;
+	LPegLoadReport report;
+};
+
+static std::vector<std::string> ListLexers(const std::string &dir) {
+	std::vector<std::string> names;
+
+#if _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((dir + "\\*.lua").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE) return names;
+	do {
+		names.push_back(std::string(data.cFileName));
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	DIR *d = opendir(dir.c_str());
+	if (d == nullptr) return names;
+	while (struct dirent *entry = readdir(d)) {
+		std::string file(entry->d_name);
+		if (file.size() > 4 && file.compare(file.size() - 4, 4, ".lua") == 0)
+			names.push_back(file);
+	}
+	closedir(d);
+#endif
+
+	for (auto &name : names) name.erase(name.size() - 4);
+
+	// The lexer module itself is not a language
+	names.erase(std::remove(names.begin(), names.end(), "lexer"), names.end());
+	std::sort(names.begin(), names.end());
+
+	return names;
+}
+
+// Loads the lexer for the language the way Scintilla would. Returns false if it failed to load.
+static bool LoadLexer(const std::string &dir, const std::string &theme, const std::string &name, LPegLoadReport *report) {
+	ILexer *lexer = GetLexerFactory(0)();
+
+	lexer->PropertySet("lexer.lpeg.home", dir.c_str());
+	if (!theme.empty()) lexer->PropertySet("lexer.lpeg.color.theme", theme.c_str());
+	lexer->PrivateCall(SCI_SETLEXERLANGUAGE, const_cast<char *>(name.c_str()));
+
+	char status[512] = { 0 };
+	lexer->PrivateCall(SCI_GETSTATUS, status);
+	if (strlen(status) > 0) {
+		fprintf(stderr, "%s: %s\n", name.c_str(), status);
+		lexer->Release();
+		return false;
+	}
+
+	lexer->PrivateCall(LPEG_GETLOADREPORT, report);
+	lexer->Release();
+	return true;
+}
+
+static double Total(const LPegLoadReport &report) {
+	return report.module_time + report.theme_time + report.load_time + report.styles_time + report.compile_time;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <lexers directory> [runs] [theme]\n", argv[0]);
+		return 1;
+	}
+
+	std::string dir(argv[1]);
+	int runs = argc > 2 ? atoi(argv[2]) : 5;
+	std::string theme = argc > 3 ? argv[3] : "";
+	if (runs < 1) runs = 1;
+
+	std::vector<LexerCost> costs;
+	for (const auto &name : ListLexers(dir)) {
+		LexerCost cost = { name, 0, LPegLoadReport() };
+		bool loaded = true;
+
+		for (int i = 0; i < runs && loaded; i++) {
+			LPegLoadReport report;
+			loaded = LoadLexer(dir, theme, name, &report);
+			if (loaded && (i == 0 || Total(report) < cost.total)) {
+				cost.report = report;
+				cost.total = Total(report);
+			}
+		}
+
+		if (loaded) costs.push_back(cost);
+	}
+
+	std::sort(costs.begin(), costs.end(), [](const LexerCost &a, const LexerCost &b) {
+		return a.total > b.total;
+	});
+
+	printf("%-16s %8s %8s %8s %8s %8s %8s %7s %7s %7s %9s\n", "lexer", "total", "module", "theme", "load",
+		"styles", "compile", "nodes", "insts", "ktable", "memory");
+	for (const auto &cost : costs) {
+		const LPegLoadReport &r = cost.report;
+		printf("%-16s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %7zu %7zu %7zu %8lldK\n", cost.name.c_str(), cost.total,
+			r.module_time, r.theme_time, r.load_time, r.styles_time, r.compile_time,
+			r.tree_size, r.code_size, r.ktable_size, r.memory_delta / 1024);
+	}
+
+	return 0;
+}